@@ -0,0 +1,356 @@
+//
+// sndfilter - Algorithms for sound filters, like reverb, lowpass, etc
+// by Sean Connelly (@velipso), https://sean.fun
+// Project Home: https://github.com/velipso/sndfilter
+// SPDX-License-Identifier: 0BSD
+//
+
+// throughput benchmarks for the filters
+// this is meant to be built on a host machine via `./build sfbench`
+//
+// every filter is run over a synthetic stereo signal at several sample rates and block sizes, and
+// the results are printed as CSV (default) or JSON so they can be diffed between releases
+
+#include "../src/biquad.h"
+#include "../src/offline.h"
+#include "../src/compressor.h"
+#include "../src/reverb.h"
+#include "../src/mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+static const int rates[] = { 44100, 48000, 96000 };
+static const int blocks[] = { 32, 128, 512, 2048, 8192, 65536 };
+#define RATES_SIZE   ((int)(sizeof(rates) / sizeof(rates[0])))
+#define BLOCKS_SIZE  ((int)(sizeof(blocks) / sizeof(blocks[0])))
+
+static const char *reverbnames[] = {
+	"default", "smallhall1", "smallhall2", "mediumhall1", "mediumhall2", "largehall1",
+	"largehall2", "smallroom1", "smallroom2", "mediumroom1", "mediumroom2", "largeroom1",
+	"largeroom2", "mediumer1", "mediumer2", "platehigh", "platelow", "longreverb1", "longreverb2"
+};
+#define REVERB_PRESETS  ((int)(sizeof(reverbnames) / sizeof(reverbnames[0])))
+
+typedef enum {
+	BQ_LOWPASS,
+	BQ_HIGHPASS,
+	BQ_BANDPASS,
+	BQ_NOTCH,
+	BQ_PEAKING,
+	BQ_ALLPASS,
+	BQ_LOWSHELF,
+	BQ_HIGHSHELF
+} bqtype;
+
+static const char *bqnames[] = {
+	"lowpass", "highpass", "bandpass", "notch", "peaking", "allpass", "lowshelf", "highshelf"
+};
+#define BQ_TYPES  ((int)(sizeof(bqnames) / sizeof(bqnames[0])))
+
+static bool json = false;
+static bool firstrow = true;
+
+static double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// fill a buffer with a deterministic test signal: two detuned sines plus a bit of noise, so the
+// filters see something resembling music instead of silence (which can hit denormal slow paths)
+static void synth(sf_sample_st *buf, int size, int rate){
+	uint32_t seed = 0x12345678;
+	float wL = 2.0f * (float)M_PI * 220.0f / (float)rate;
+	float wR = 2.0f * (float)M_PI * 331.0f / (float)rate;
+	for (int i = 0; i < size; i++){
+		seed = seed * 1664525 + 1013904223;
+		float noise = (float)(seed >> 8) / 16777216.0f - 0.5f;
+		buf[i].L = 0.5f * sinf(wL * (float)i) + 0.1f * noise;
+		buf[i].R = 0.5f * sinf(wR * (float)i) - 0.1f * noise;
+	}
+}
+
+static void report(const char *filter, const char *variant, int rate, int block, long samples,
+	double secs){
+	double sps = secs > 0 ? (double)samples / secs : 0;
+	double rt = sps / (double)rate;
+	double nsps = samples > 0 ? secs * 1e9 / (double)samples : 0;
+	if (json){
+		printf("%s\n    {\"filter\": \"%s\", \"variant\": \"%s\", \"rate\": %d, \"block\": %d, "
+			"\"samples\": %ld, \"seconds\": %.6f, \"samples_per_sec\": %.1f, \"realtime\": %.3f, "
+			"\"ns_per_sample\": %.3f}", firstrow ? "" : ",", filter, variant, rate, block, samples,
+			secs, sps, rt, nsps);
+	}
+	else{
+		printf("%s,%s,%d,%d,%ld,%.6f,%.1f,%.3f,%.3f\n", filter, variant, rate, block, samples,
+			secs, sps, rt, nsps);
+	}
+	firstrow = false;
+	fflush(stdout);
+}
+
+static void bq_make(sf_biquad_state_st *state, bqtype type, int rate){
+	switch (type){
+		case BQ_LOWPASS  : sf_lowpass  (state, rate, 1000.0f, 3.0f);         break;
+		case BQ_HIGHPASS : sf_highpass (state, rate, 1000.0f, 3.0f);         break;
+		case BQ_BANDPASS : sf_bandpass (state, rate, 1000.0f, 0.7f);         break;
+		case BQ_NOTCH    : sf_notch    (state, rate, 1000.0f, 0.7f);         break;
+		case BQ_PEAKING  : sf_peaking  (state, rate, 1000.0f, 0.7f, 6.0f);   break;
+		case BQ_ALLPASS  : sf_allpass  (state, rate, 1000.0f, 0.7f);         break;
+		case BQ_LOWSHELF : sf_lowshelf (state, rate, 200.0f, 1.0f, 6.0f);    break;
+		case BQ_HIGHSHELF: sf_highshelf(state, rate, 6000.0f, 1.0f, 6.0f);   break;
+	}
+}
+
+// each benchmark streams `total` samples through the filter in chunks of `block` samples, reusing
+// the same input region so the measurement isn't dominated by page faults on a huge buffer
+static double bench_biquad(bqtype type, int rate, int block, long total, sf_sample_st *input,
+	sf_sample_st *output){
+	sf_biquad_state_st state;
+	bq_make(&state, type, rate);
+	double start = now();
+	for (long done = 0; done < total; done += block)
+		sf_biquad_process(&state, block, input, output);
+	return now() - start;
+}
+
+// a lowpass whose cutoff sweeps up and down once a second, retargeted every block and ramped
+// across it, to compare the cost of automation with a fixed lowpass
+static double bench_sweep(int rate, int block, long total, sf_sample_st *input,
+	sf_sample_st *output){
+	sf_biquad_state_st design;
+	bq_make(&design, BQ_LOWPASS, rate);
+	sf_biquad_smooth_st sweep;
+	sf_biquad_smooth_init(&sweep, &design);
+	double start = now();
+	for (long done = 0; done < total; done += block){
+		float phase = (float)(done % rate) / (float)rate;
+		float cutoff = 200.0f + 4000.0f * (phase < 0.5f ? phase : 1.0f - phase);
+		sf_lowpass(&design, rate, cutoff, 3.0f);
+		sf_biquad_smooth_target(&sweep, &design, block);
+		sf_biquad_smooth_process(&sweep, block, input, output);
+	}
+	return now() - start;
+}
+
+// an EQ made of one biquad of each type, either processed one biquad at a time over each block, or
+// as a chain
+static double bench_eq(bool chain, int rate, int block, long total, sf_sample_st *input,
+	sf_sample_st *output){
+	sf_biquad_state_st states[BQ_TYPES];
+	sf_biquad_chain_st eq;
+	sf_biquad_chain_init(&eq);
+	for (int t = 0; t < BQ_TYPES; t++){
+		bq_make(&states[t], (bqtype)t, rate);
+		sf_biquad_chain_add(&eq, &states[t]);
+	}
+	double start = now();
+	for (long done = 0; done < total; done += block){
+		if (chain)
+			sf_biquad_chain_process(&eq, block, input, output);
+		else{
+			sf_biquad_process(&states[0], block, input, output);
+			for (int t = 1; t < BQ_TYPES; t++)
+				sf_biquad_process(&states[t], block, output, output);
+		}
+	}
+	return now() - start;
+}
+
+// one lowpass over `streams` mono streams at once, each stream `block` samples long in `planar`
+static double bench_batch(int streams, int rate, int block, long total, float *planar){
+	sf_biquad_state_st design;
+	bq_make(&design, BQ_LOWPASS, rate);
+	sf_biquad_batch_st batch;
+	sf_biquad_batch_init(&batch, streams, &design);
+	float *bufs[SF_BIQUAD_BATCH_MAX];
+	for (int k = 0; k < streams; k++)
+		bufs[k] = &planar[(size_t)k * block];
+	double start = now();
+	for (long done = 0; done < total; done += block)
+		sf_biquad_batch_process(&batch, block, bufs, bufs);
+	return now() - start;
+}
+
+// one lowpass over a whole sound of `size` samples in memory, split across `threads` threads
+static double bench_parallel(int threads, int rate, int64_t size, sf_sample_st *sound){
+	sf_biquad_state_st state;
+	bq_make(&state, BQ_LOWPASS, rate);
+	double start = now();
+	sf_biquad_process_parallel(&state, size, sound, sound, threads);
+	return now() - start;
+}
+
+static double bench_compressor(sf_compressor_state_st *state, int rate, int block, long total,
+	sf_sample_st *input, sf_sample_st *output){
+	sf_defaultcomp(state, rate);
+	double start = now();
+	for (long done = 0; done < total; done += block)
+		sf_compressor_process(state, block, input, output);
+	return now() - start;
+}
+
+// returns a negative time if the state can't be allocated
+static double bench_reverb(sf_reverb_preset preset, int rate, int block, long total,
+	sf_sample_st *input, sf_sample_st *output){
+	sf_reverb_state_st *state = sf_reverb_new(rate, preset);
+	if (state == NULL)
+		return -1;
+	double start = now();
+	for (long done = 0; done < total; done += block)
+		sf_reverb_process(state, block, input, output);
+	double secs = now() - start;
+	sf_reverb_free(state);
+	return secs;
+}
+
+// match a filter name against the optional command line filter (NULL means run everything)
+static bool want(const char *only, const char *filter){
+	return only == NULL || strcmp(only, filter) == 0;
+}
+
+static int printhelp(){
+	printf(
+		"sfbench - throughput benchmarks for sndfilter\n"
+		"\n"
+		"Usage:\n"
+		"  sfbench [--json] [--seconds <n>] [--only <filter>]\n"
+		"\n"
+		"Where:\n"
+		"  --json       Output JSON instead of CSV\n"
+		"  --seconds    Seconds of audio to process per measurement (default 2)\n"
+		"  --only       Only run one filter: biquad, eq, batch, parallel, compressor, or reverb\n");
+	return 0;
+}
+
+int main(int argc, char **argv){
+	float seconds = 2.0f;
+	const char *only = NULL;
+	for (int i = 1; i < argc; i++){
+		if (strcmp(argv[i], "--json") == 0)
+			json = true;
+		else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+			seconds = atof(argv[++i]);
+		else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc)
+			only = argv[++i];
+		else
+			return printhelp();
+	}
+	if (seconds <= 0){
+		fprintf(stderr, "Error: Bad number of seconds\n");
+		return 1;
+	}
+
+	int maxblock = blocks[BLOCKS_SIZE - 1];
+	size_t bufsize = sf_alignsize(sizeof(sf_sample_st) * maxblock);
+	sf_sample_st *input  = (sf_sample_st *)sf_aligned_malloc(bufsize, SF_ALIGN);
+	sf_sample_st *output = (sf_sample_st *)sf_aligned_malloc(bufsize, SF_ALIGN);
+	float *planar = (float *)sf_aligned_malloc(
+		sf_alignsize(sizeof(float) * SF_BIQUAD_BATCH_MAX * maxblock), SF_ALIGN);
+	sf_compressor_state_st *cm =
+		(sf_compressor_state_st *)sf_malloc(sizeof(sf_compressor_state_st));
+	if (input == NULL || output == NULL || planar == NULL || cm == NULL){
+		fprintf(stderr, "Error: Out of memory\n");
+		return 1;
+	}
+
+	if (json)
+		printf("[");
+	else
+		printf("filter,variant,rate,block,samples,seconds,samples_per_sec,realtime,"
+			"ns_per_sample\n");
+
+	for (int r = 0; r < RATES_SIZE; r++){
+		int rate = rates[r];
+		synth(input, maxblock, rate);
+		for (int b = 0; b < BLOCKS_SIZE; b++){
+			int block = blocks[b];
+			// round the total up to a whole number of blocks
+			long total = (long)(seconds * rate);
+			total = ((total + block - 1) / block) * block;
+
+			if (want(only, "biquad")){
+				for (int t = 0; t < BQ_TYPES; t++){
+					double secs = bench_biquad((bqtype)t, rate, block, total, input, output);
+					report("biquad", bqnames[t], rate, block, total, secs);
+				}
+				double secs = bench_sweep(rate, block, total, input, output);
+				report("biquad", "sweep", rate, block, total, secs);
+			}
+
+			if (want(only, "eq")){
+				double secs = bench_eq(false, rate, block, total, input, output);
+				report("eq", "separate", rate, block, total, secs);
+				secs = bench_eq(true, rate, block, total, input, output);
+				report("eq", "chain", rate, block, total, secs);
+			}
+
+			// the batches report the samples of all streams together, so the numbers compare with
+			// running each stream through its own biquad
+			if (want(only, "batch")){
+				static const int widths[] = { 4, 8, 16 };
+				static const char *widthnames[] = { "x4", "x8", "x16" };
+				for (int w = 0; w < 3; w++){
+					for (int k = 0; k < widths[w]; k++){
+						for (int i = 0; i < block; i++){
+							planar[(size_t)k * block + i] =
+								(k & 1) ? input[i].R : input[i].L;
+						}
+					}
+					double secs = bench_batch(widths[w], rate, block, total, planar);
+					report("batch", widthnames[w], rate, block, total * widths[w], secs);
+				}
+			}
+
+			// the whole sound is filtered in one call, so this only runs once per rate, and
+			// reports the size of the sound as the block
+			if (want(only, "parallel") && b == BLOCKS_SIZE - 1){
+				static const int threads[] = { 1, 2, 4, 8 };
+				static const char *threadnames[] = { "x1", "x2", "x4", "x8" };
+				sf_sample_st *sound = (sf_sample_st *)sf_aligned_malloc(
+					sf_alignsize(sizeof(sf_sample_st) * total), SF_ALIGN);
+				if (sound == NULL){
+					fprintf(stderr, "Error: Out of memory\n");
+					return 1;
+				}
+				for (int t = 0; t < 4; t++){
+					for (long i = 0; i < total; i += maxblock)
+						memcpy(&sound[i], input, sizeof(sf_sample_st) * maxblock);
+					double secs = bench_parallel(threads[t], rate, total, sound);
+					report("parallel", threadnames[t], rate, (int)total, total, secs);
+				}
+				sf_aligned_free(sound);
+			}
+
+			if (want(only, "compressor")){
+				double secs = bench_compressor(cm, rate, block, total, input, output);
+				report("compressor", "default", rate, block, total, secs);
+			}
+
+			if (want(only, "reverb")){
+				for (int p = 0; p < REVERB_PRESETS; p++){
+					double secs = bench_reverb((sf_reverb_preset)p, rate, block, total, input,
+						output);
+					if (secs < 0){
+						fprintf(stderr, "Error: Out of memory\n");
+						return 1;
+					}
+					report("reverb", reverbnames[p], rate, block, total, secs);
+				}
+			}
+		}
+	}
+
+	if (json)
+		printf("\n]\n");
+
+	sf_aligned_free(input);
+	sf_aligned_free(output);
+	sf_aligned_free(planar);
+	sf_free(cm);
+	return 0;
+}
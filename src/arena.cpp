@@ -0,0 +1,190 @@
+//
+// sndfilter - Algorithms for sound filters, like reverb, lowpass, etc
+// by Sean Connelly (@velipso), https://sean.fun
+// Project Home: https://github.com/velipso/sndfilter
+// SPDX-License-Identifier: 0BSD
+//
+
+#include "arena.h"
+#include "mem.h"
+
+// default alignment of allocations, and size of the header in front of allocations made through
+// the sf_malloc hook (enough for any basic type)
+#define ARENA_ALIGN  16
+
+// chunks form a list in the order they were allocated; the data follows the chunk header
+typedef struct chunk_st {
+	struct chunk_st *next;
+	size_t size; // bytes of data
+	size_t used; // bytes of data handed out
+} chunk_st;
+
+#define CHUNK_HDRSIZE  ((sizeof(chunk_st) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct sf_arena_st {
+	chunk_st *first;
+	chunk_st *cur; // chunk being allocated from; the chunks after it are unused
+	size_t chunksize;
+	size_t used;
+	size_t highwater;
+	size_t capacity;
+	int64_t allocs;
+	int64_t resets;
+};
+
+// allocator for the chunks, and for the sf_malloc hook when a thread doesn't have an arena
+static sf_malloc_func base_malloc = NULL;
+static sf_free_func base_free = NULL;
+static thread_local sf_arena_st *current = NULL;
+
+static inline void *chunk_data(chunk_st *c){
+	return (uint8_t *)c + CHUNK_HDRSIZE;
+}
+
+static inline sf_malloc_func get_malloc(){
+	return base_malloc ? base_malloc : sf_malloc;
+}
+
+static inline sf_free_func get_free(){
+	return base_free ? base_free : sf_free;
+}
+
+sf_arena_st *sf_arena_new(size_t chunksize){
+	sf_arena_st *arena = (sf_arena_st *)get_malloc()(sizeof(sf_arena_st));
+	if (arena == NULL)
+		return NULL;
+	arena->first = NULL;
+	arena->cur = NULL;
+	arena->chunksize = chunksize > 0 ? chunksize : SF_ARENA_CHUNKSIZE;
+	arena->used = 0;
+	arena->highwater = 0;
+	arena->capacity = 0;
+	arena->allocs = 0;
+	arena->resets = 0;
+	return arena;
+}
+
+void sf_arena_free(sf_arena_st *arena){
+	sf_free_func f = get_free();
+	chunk_st *c = arena->first;
+	while (c){
+		chunk_st *next = c->next;
+		f(c);
+		c = next;
+	}
+	if (current == arena)
+		current = NULL;
+	f(arena);
+}
+
+// find room for `need` bytes (including worst case alignment) in the chunks after the current one,
+// or allocate a new chunk right after the current one
+static chunk_st *next_chunk(sf_arena_st *arena, size_t need){
+	chunk_st *c = arena->cur ? arena->cur->next : arena->first;
+	while (c && c->size < need)
+		c = c->next;
+	if (c == NULL){
+		size_t size = need > arena->chunksize ? need : arena->chunksize;
+		if (size > SIZE_MAX - CHUNK_HDRSIZE)
+			return NULL;
+		c = (chunk_st *)get_malloc()(CHUNK_HDRSIZE + size);
+		if (c == NULL)
+			return NULL;
+		c->size = size;
+		arena->capacity += size;
+		if (arena->cur){
+			c->next = arena->cur->next;
+			arena->cur->next = c;
+		}
+		else{
+			c->next = arena->first;
+			arena->first = c;
+		}
+	}
+	// chunks skipped over stay unused until the next reset
+	c->used = 0;
+	arena->cur = c;
+	return c;
+}
+
+void *sf_arena_alloc(sf_arena_st *arena, size_t size, size_t align){
+	if (align < ARENA_ALIGN)
+		align = ARENA_ALIGN;
+	if (size > SIZE_MAX - align)
+		return NULL;
+	chunk_st *c = arena->cur;
+	uintptr_t base = c ? (uintptr_t)chunk_data(c) : 0;
+	uintptr_t p = c ? (base + c->used + align - 1) & ~(uintptr_t)(align - 1) : 0;
+	if (c == NULL || p - base > c->size || size > c->size - (p - base)){
+		c = next_chunk(arena, size + align - 1);
+		if (c == NULL)
+			return NULL;
+		base = (uintptr_t)chunk_data(c);
+		p = (base + align - 1) & ~(uintptr_t)(align - 1);
+	}
+	size_t end = (p - base) + size;
+	arena->used += end - c->used;
+	c->used = end;
+	if (arena->used > arena->highwater)
+		arena->highwater = arena->used;
+	arena->allocs++;
+	return (void *)p;
+}
+
+void sf_arena_reset(sf_arena_st *arena){
+	// the chunks after the first get their `used` cleared as they're reached again
+	if (arena->first)
+		arena->first->used = 0;
+	arena->cur = arena->first;
+	arena->used = 0;
+	arena->resets++;
+}
+
+void sf_arena_getstats(sf_arena_st *arena, sf_arena_stats_st *stats){
+	stats->used = arena->used;
+	stats->highwater = arena->highwater;
+	stats->capacity = arena->capacity;
+	stats->allocs = arena->allocs;
+	stats->resets = arena->resets;
+}
+
+// the hooks put a header in front of every allocation that remembers the arena it came from (or
+// NULL for the base allocator), so sf_free knows what to do with memory allocated before or after
+// a thread switched arenas
+static void *hook_malloc(size_t size){
+	if (size > SIZE_MAX - ARENA_ALIGN)
+		return NULL;
+	sf_arena_st *arena = current;
+	void *mem = arena ? sf_arena_alloc(arena, ARENA_ALIGN + size, ARENA_ALIGN) :
+		base_malloc(ARENA_ALIGN + size);
+	if (mem == NULL)
+		return NULL;
+	*(sf_arena_st **)mem = arena;
+	return (uint8_t *)mem + ARENA_ALIGN;
+}
+
+static void hook_free(void *ptr){
+	if (ptr == NULL)
+		return;
+	void *mem = (uint8_t *)ptr - ARENA_ALIGN;
+	// arena memory is released when the arena is reset
+	if (*(sf_arena_st **)mem == NULL)
+		base_free(mem);
+}
+
+void sf_arena_install(){
+	if (base_malloc)
+		return;
+	base_malloc = sf_malloc;
+	base_free = sf_free;
+	sf_malloc = hook_malloc;
+	sf_free = hook_free;
+}
+
+void sf_arena_use(sf_arena_st *arena){
+	current = arena;
+}
+
+sf_arena_st *sf_arena_current(){
+	return current;
+}
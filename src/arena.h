@@ -0,0 +1,84 @@
+//
+// sndfilter - Algorithms for sound filters, like reverb, lowpass, etc
+// by Sean Connelly (@velipso), https://sean.fun
+// Project Home: https://github.com/velipso/sndfilter
+// SPDX-License-Identifier: 0BSD
+//
+
+// arena allocator, for jobs that allocate a bunch of buffers and throw them all away at the end
+
+#ifndef SNDFILTER_ARENA__H
+#define SNDFILTER_ARENA__H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// an arena hands out memory by bumping a pointer through large chunks, and releases everything at
+// once when it's reset; freeing a single allocation does nothing
+//
+// resetting doesn't give the chunks back, so a job that runs again in the same arena reuses them
+// without touching malloc at all, which avoids lock contention and fragmentation in the global heap
+// when many threads run jobs at the same time
+//
+// an arena isn't thread safe by itself; give each thread (or job) its own
+//
+// memory from an arena must not be used, or passed to sf_free, after the arena is reset or freed
+//
+// for example, to have every sf_malloc in a job come out of an arena:
+//
+//   sf_arena_install(); // once, at startup
+//   ...
+//   sf_arena_st *arena = sf_arena_new(0);
+//   sf_arena_use(arena);
+//   sf_snd snd = sf_wavload("input.wav"); // allocated in the arena
+//   ...
+//   sf_arena_use(NULL);
+//   sf_arena_reset(arena); // releases `snd` and everything else from the job
+//   ...
+//   sf_arena_free(arena);
+
+// default size of the chunks that are allocated as the arena grows
+#ifndef SF_ARENA_CHUNKSIZE
+#define SF_ARENA_CHUNKSIZE  (1 << 20)
+#endif
+
+typedef struct sf_arena_st sf_arena_st;
+
+typedef struct {
+	size_t used;      // bytes handed out since the last reset (including alignment padding)
+	size_t highwater; // most bytes that were ever in use at the same time
+	size_t capacity;  // total size of the chunks owned by the arena
+	int64_t allocs;   // number of allocations since the arena was created
+	int64_t resets;   // number of times the arena was reset
+} sf_arena_stats_st;
+
+// create an arena that grows by `chunksize` bytes at a time (0 for SF_ARENA_CHUNKSIZE)
+// the arena is empty until the first allocation (returns NULL for error)
+sf_arena_st *sf_arena_new(size_t chunksize);
+
+// free the arena and all of its chunks; the memory handed out is no longer valid
+void sf_arena_free(sf_arena_st *arena);
+
+// allocate `size` bytes aligned to `align` (a power of two, or 0 for the default) from the arena
+// (returns NULL for error)
+void *sf_arena_alloc(sf_arena_st *arena, size_t size, size_t align);
+
+// release everything allocated from the arena in O(1), keeping the chunks for reuse
+void sf_arena_reset(sf_arena_st *arena);
+
+void sf_arena_getstats(sf_arena_st *arena, sf_arena_stats_st *stats);
+
+// replace sf_malloc/sf_free (see mem.h) with hooks that allocate from the calling thread's current
+// arena, or fall back to the previous sf_malloc/sf_free when the thread doesn't have one
+// call this once before anything is allocated, and before starting any threads
+void sf_arena_install();
+
+// set the current arena of the calling thread (NULL for none)
+// the arena chunks themselves are always allocated with the previous sf_malloc
+void sf_arena_use(sf_arena_st *arena);
+
+// current arena of the calling thread
+sf_arena_st *sf_arena_current();
+
+#endif // SNDFILTER_ARENA__H
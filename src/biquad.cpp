@@ -6,7 +6,14 @@
 //
 
 #include "biquad.h"
+#include "denormal.h"
 #include <math.h>
+#include <string.h>
+
+#if SF_BIQUAD_SIMD && (defined(__x86_64__) || defined(__i386__))
+#	include <immintrin.h>
+#	define KERNEL_SSE
+#endif
 
 // biquad filtering is based on a small sliding window, where the different filters are a result of
 // simply changing the coefficients used while processing the samples
@@ -15,7 +22,7 @@
 //   b0, b1, b2, a1, a2      transformation coefficients
 //   xn0, xn1, xn2           the unfiltered sample at position x[n], x[n-1], and x[n-2]
 //   yn1, yn2                the filtered sample at position y[n-1] and y[n-2]
-void sf_biquad_process(sf_biquad_state_st *state, int size, sf_sample_st *input,
+static void process_scalar(sf_biquad_state_st *state, int64_t size, const sf_sample_st *input,
 	sf_sample_st *output){
 
 	// pull out the state into local variables
@@ -30,8 +37,8 @@ void sf_biquad_process(sf_biquad_state_st *state, int size, sf_sample_st *input,
 	sf_sample_st yn2 = state->yn2;
 
 	// loop for each sample
-	for (int n = 0; n < size; n++){
-		// get the current sample
+	for (int64_t n = 0; n < size; n++){
+		// get the current sample (before output[n] is written, in case they're the same)
 		sf_sample_st xn0 = input[n];
 
 		// the formula is the same for each channel
@@ -49,7 +56,7 @@ void sf_biquad_process(sf_biquad_state_st *state, int size, sf_sample_st *input,
 			a2 * yn2.R;
 
 		// save the result
-		output[n] = (sf_sample_st){ L, R };
+		output[n] = (sf_sample_st){ sf_denormal_flush(L), sf_denormal_flush(R) };
 
 		// slide everything down one sample
 		xn2 = xn1;
@@ -65,6 +72,697 @@ void sf_biquad_process(sf_biquad_state_st *state, int size, sf_sample_st *input,
 	state->yn2 = yn2;
 }
 
+// same as process_scalar, but stepping the coefficients before every sample
+static void ramp_scalar(sf_biquad_smooth_st *smooth, int64_t size, const sf_sample_st *input,
+	sf_sample_st *output){
+	sf_biquad_state_st *state = &smooth->biquad;
+	float b0 = state->b0;
+	float b1 = state->b1;
+	float b2 = state->b2;
+	float a1 = state->a1;
+	float a2 = state->a2;
+	float db0 = smooth->db0;
+	float db1 = smooth->db1;
+	float db2 = smooth->db2;
+	float da1 = smooth->da1;
+	float da2 = smooth->da2;
+	sf_sample_st xn1 = state->xn1;
+	sf_sample_st xn2 = state->xn2;
+	sf_sample_st yn1 = state->yn1;
+	sf_sample_st yn2 = state->yn2;
+
+	for (int64_t n = 0; n < size; n++){
+		b0 += db0;
+		b1 += db1;
+		b2 += db2;
+		a1 += da1;
+		a2 += da2;
+		sf_sample_st xn0 = input[n];
+		float L =
+			b0 * xn0.L +
+			b1 * xn1.L +
+			b2 * xn2.L -
+			a1 * yn1.L -
+			a2 * yn2.L;
+		float R =
+			b0 * xn0.R +
+			b1 * xn1.R +
+			b2 * xn2.R -
+			a1 * yn1.R -
+			a2 * yn2.R;
+		output[n] = (sf_sample_st){ sf_denormal_flush(L), sf_denormal_flush(R) };
+		xn2 = xn1;
+		xn1 = xn0;
+		yn2 = yn1;
+		yn1 = output[n];
+	}
+
+	state->b0 = b0;
+	state->b1 = b1;
+	state->b2 = b2;
+	state->a1 = a1;
+	state->a2 = a2;
+	state->xn1 = xn1;
+	state->xn2 = xn2;
+	state->yn1 = yn1;
+	state->yn2 = yn2;
+}
+
+// batches run one stream per lane: the vector versions load four samples from each of four
+// streams, transpose them in registers so each register holds one sample of all four streams, run
+// the four steps, and transpose them back; the streams and samples that don't fill a whole tile
+// are left to the scalar version
+
+// process streams `first` to `last - 1`, from sample `start` to `size - 1`
+static void batch_range(sf_biquad_batch_st *batch, int first, int last, int64_t start,
+	int64_t size, const float *const *input, float *const *output){
+	float b0 = batch->b0;
+	float b1 = batch->b1;
+	float b2 = batch->b2;
+	float a1 = batch->a1;
+	float a2 = batch->a2;
+	for (int k = first; k < last; k++){
+		const float *in = input[k];
+		float *out = output[k];
+		float x1 = batch->xn1[k], x2 = batch->xn2[k], y1 = batch->yn1[k], y2 = batch->yn2[k];
+		for (int64_t n = start; n < size; n++){
+			float x0 = in[n];
+			float y0 =
+				b0 * x0 +
+				b1 * x1 +
+				b2 * x2 -
+				a1 * y1 -
+				a2 * y2;
+			y0 = sf_denormal_flush(y0);
+			out[n] = y0;
+			x2 = x1;
+			x1 = x0;
+			y2 = y1;
+			y1 = y0;
+		}
+		batch->xn1[k] = x1;
+		batch->xn2[k] = x2;
+		batch->yn1[k] = y1;
+		batch->yn2[k] = y2;
+	}
+}
+
+static void batch_scalar(sf_biquad_batch_st *batch, int64_t size, const float *const *input,
+	float *const *output){
+	batch_range(batch, 0, batch->size, 0, size, input, output);
+}
+
+// the vector versions work on two samples (four floats) at a time
+//
+// the feedforward half of the formula (b0 * xn0 + b1 * xn1 + b2 * xn2) doesn't depend on the
+// output, so it's calculated for both samples at once; the feedback half then runs one sample at a
+// time, with both channels in the same register
+//
+// the odd sample at the end is left to process_scalar
+
+#if defined(KERNEL_SSE)
+
+// compiled for SSE even when the rest of the file isn't, since the CPU is checked before it's used
+__attribute__((target("sse")))
+static void process_sse(sf_biquad_state_st *state, int64_t size, const sf_sample_st *input,
+	sf_sample_st *output){
+	__m128 b0 = _mm_set1_ps(state->b0);
+	__m128 b1 = _mm_set1_ps(state->b1);
+	__m128 b2 = _mm_set1_ps(state->b2);
+	__m128 a1 = _mm_set1_ps(state->a1);
+	__m128 a2 = _mm_set1_ps(state->a2);
+	// the history of two samples: x[n-2], x[n-1] and y[n-2], y[n-1]
+	__m128 xh = _mm_setr_ps(state->xn2.L, state->xn2.R, state->xn1.L, state->xn1.R);
+	__m128 yh = _mm_setr_ps(state->yn2.L, state->yn2.R, state->yn1.L, state->yn1.R);
+
+	int64_t n = 0;
+	for (; n + 1 < size; n += 2){
+		__m128 x0 = _mm_loadu_ps(&input[n].L);                      // x[n], x[n+1]
+		__m128 x1 = _mm_shuffle_ps(xh, x0, _MM_SHUFFLE(1, 0, 3, 2)); // x[n-1], x[n]
+		__m128 ff = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, x0), _mm_mul_ps(b1, x1)),
+			_mm_mul_ps(b2, xh));
+		// y[n] in the low half of t, then y[n+1] in the high half of u
+		__m128 yn1 = _mm_movehl_ps(yh, yh); // y[n-1], y[n-1]
+		__m128 t = _mm_sub_ps(_mm_sub_ps(ff, _mm_mul_ps(a1, yn1)), _mm_mul_ps(a2, yh));
+		__m128 u = _mm_sub_ps(_mm_sub_ps(ff, _mm_mul_ps(a1, _mm_movelh_ps(t, t))),
+			_mm_mul_ps(a2, yn1));
+		yh = _mm_shuffle_ps(t, u, _MM_SHUFFLE(3, 2, 1, 0));
+		xh = x0;
+		_mm_storeu_ps(&output[n].L, yh);
+	}
+
+	float h[4];
+	_mm_storeu_ps(h, xh);
+	state->xn2 = (sf_sample_st){ h[0], h[1] };
+	state->xn1 = (sf_sample_st){ h[2], h[3] };
+	_mm_storeu_ps(h, yh);
+	state->yn2 = (sf_sample_st){ h[0], h[1] };
+	state->yn1 = (sf_sample_st){ h[2], h[3] };
+	process_scalar(state, size - n, &input[n], &output[n]);
+}
+
+// step the coefficient `c` of the last sample forward twice, and return it for the next two
+// samples: c[n], c[n+1]
+__attribute__((target("sse")))
+static inline __m128 ramp_step_sse(__m128 *c, __m128 d){
+	__m128 lo = _mm_add_ps(*c, d);
+	*c = _mm_add_ps(lo, d);
+	return _mm_movelh_ps(lo, *c);
+}
+
+__attribute__((target("sse")))
+static void ramp_sse(sf_biquad_smooth_st *smooth, int64_t size, const sf_sample_st *input,
+	sf_sample_st *output){
+	sf_biquad_state_st *state = &smooth->biquad;
+	// the coefficients of the last sample, in every lane
+	__m128 b0 = _mm_set1_ps(state->b0);
+	__m128 b1 = _mm_set1_ps(state->b1);
+	__m128 b2 = _mm_set1_ps(state->b2);
+	__m128 a1 = _mm_set1_ps(state->a1);
+	__m128 a2 = _mm_set1_ps(state->a2);
+	__m128 db0 = _mm_set1_ps(smooth->db0);
+	__m128 db1 = _mm_set1_ps(smooth->db1);
+	__m128 db2 = _mm_set1_ps(smooth->db2);
+	__m128 da1 = _mm_set1_ps(smooth->da1);
+	__m128 da2 = _mm_set1_ps(smooth->da2);
+	__m128 xh = _mm_setr_ps(state->xn2.L, state->xn2.R, state->xn1.L, state->xn1.R);
+	__m128 yh = _mm_setr_ps(state->yn2.L, state->yn2.R, state->yn1.L, state->yn1.R);
+
+	int64_t n = 0;
+	for (; n + 1 < size; n += 2){
+		// the a1 and a2 for y[n] are in the low half, which is the half t uses, and the ones for
+		// y[n+1] are in the high half, which is the half u uses
+		__m128 cb0 = ramp_step_sse(&b0, db0);
+		__m128 cb1 = ramp_step_sse(&b1, db1);
+		__m128 cb2 = ramp_step_sse(&b2, db2);
+		__m128 ca1 = ramp_step_sse(&a1, da1);
+		__m128 ca2 = ramp_step_sse(&a2, da2);
+		__m128 x0 = _mm_loadu_ps(&input[n].L);
+		__m128 x1 = _mm_shuffle_ps(xh, x0, _MM_SHUFFLE(1, 0, 3, 2));
+		__m128 ff = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cb0, x0), _mm_mul_ps(cb1, x1)),
+			_mm_mul_ps(cb2, xh));
+		__m128 yn1 = _mm_movehl_ps(yh, yh);
+		__m128 t = _mm_sub_ps(_mm_sub_ps(ff, _mm_mul_ps(ca1, yn1)), _mm_mul_ps(ca2, yh));
+		__m128 u = _mm_sub_ps(_mm_sub_ps(ff, _mm_mul_ps(ca1, _mm_movelh_ps(t, t))),
+			_mm_mul_ps(ca2, yn1));
+		yh = _mm_shuffle_ps(t, u, _MM_SHUFFLE(3, 2, 1, 0));
+		xh = x0;
+		_mm_storeu_ps(&output[n].L, yh);
+	}
+
+	state->b0 = _mm_cvtss_f32(b0);
+	state->b1 = _mm_cvtss_f32(b1);
+	state->b2 = _mm_cvtss_f32(b2);
+	state->a1 = _mm_cvtss_f32(a1);
+	state->a2 = _mm_cvtss_f32(a2);
+	float h[4];
+	_mm_storeu_ps(h, xh);
+	state->xn2 = (sf_sample_st){ h[0], h[1] };
+	state->xn1 = (sf_sample_st){ h[2], h[3] };
+	_mm_storeu_ps(h, yh);
+	state->yn2 = (sf_sample_st){ h[0], h[1] };
+	state->yn1 = (sf_sample_st){ h[2], h[3] };
+	ramp_scalar(smooth, size - n, &input[n], &output[n]);
+}
+
+static inline __m128 pair_load(const sf_sample_st *first, const sf_sample_st *second){
+	return _mm_setr_ps(first->L, first->R, second->L, second->R);
+}
+
+static inline void pair_store(__m128 v, sf_sample_st *first, sf_sample_st *second){
+	float h[4];
+	_mm_storeu_ps(h, v);
+	*first = (sf_sample_st){ h[0], h[1] };
+	*second = (sf_sample_st){ h[2], h[3] };
+}
+
+// see pair_scalar below
+__attribute__((target("sse")))
+static void pair_sse(sf_biquad_state_st *first, sf_biquad_state_st *second, int64_t size,
+	const sf_sample_st *input, sf_sample_st *output){
+	__m128 b0 = _mm_setr_ps(first->b0, first->b0, second->b0, second->b0);
+	__m128 b1 = _mm_setr_ps(first->b1, first->b1, second->b1, second->b1);
+	__m128 b2 = _mm_setr_ps(first->b2, first->b2, second->b2, second->b2);
+	__m128 a1 = _mm_setr_ps(first->a1, first->a1, second->a1, second->a1);
+	__m128 a2 = _mm_setr_ps(first->a2, first->a2, second->a2, second->a2);
+
+	sf_sample_st y;
+	process_scalar(first, 1, &input[0], &y);
+
+	__m128 xn1 = pair_load(&first->xn1, &second->xn1);
+	__m128 xn2 = pair_load(&first->xn2, &second->xn2);
+	__m128 yn1 = pair_load(&first->yn1, &second->yn1);
+	__m128 yn2 = pair_load(&first->yn2, &second->yn2);
+	__m128 y0 = _mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)&y);
+	for (int64_t n = 1; n < size; n++){
+		__m128 x0 = _mm_movelh_ps(_mm_loadl_pi(y0, (const __m64 *)&input[n]), y0);
+		y0 = _mm_sub_ps(_mm_sub_ps(
+			_mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, x0), _mm_mul_ps(b1, xn1)), _mm_mul_ps(b2, xn2)),
+			_mm_mul_ps(a1, yn1)), _mm_mul_ps(a2, yn2));
+		_mm_storeh_pi((__m64 *)&output[n - 1], y0);
+		xn2 = xn1;
+		xn1 = x0;
+		yn2 = yn1;
+		yn1 = y0;
+	}
+
+	pair_store(xn1, &first->xn1, &second->xn1);
+	pair_store(xn2, &first->xn2, &second->xn2);
+	pair_store(yn1, &first->yn1, &second->yn1);
+	pair_store(yn2, &first->yn2, &second->yn2);
+	_mm_storel_pi((__m64 *)&y, y0);
+	process_scalar(second, 1, &y, &output[size - 1]);
+}
+
+// process streams `k` to `k + 3`
+__attribute__((target("sse")))
+static void batch_group_sse(sf_biquad_batch_st *batch, int k, int64_t size,
+	const float *const *input, float *const *output){
+	__m128 b0 = _mm_set1_ps(batch->b0);
+	__m128 b1 = _mm_set1_ps(batch->b1);
+	__m128 b2 = _mm_set1_ps(batch->b2);
+	__m128 a1 = _mm_set1_ps(batch->a1);
+	__m128 a2 = _mm_set1_ps(batch->a2);
+	__m128 xn1 = _mm_loadu_ps(&batch->xn1[k]);
+	__m128 xn2 = _mm_loadu_ps(&batch->xn2[k]);
+	__m128 yn1 = _mm_loadu_ps(&batch->yn1[k]);
+	__m128 yn2 = _mm_loadu_ps(&batch->yn2[k]);
+	int64_t tiled = size & ~3;
+	for (int64_t n = 0; n < tiled; n += 4){
+		__m128 r[4];
+		for (int j = 0; j < 4; j++)
+			r[j] = _mm_loadu_ps(&input[k + j][n]);
+		_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+		for (int j = 0; j < 4; j++){
+			__m128 x0 = r[j];
+			__m128 y0 = _mm_sub_ps(_mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, x0),
+				_mm_mul_ps(b1, xn1)), _mm_mul_ps(b2, xn2)), _mm_mul_ps(a1, yn1)),
+				_mm_mul_ps(a2, yn2));
+			r[j] = y0;
+			xn2 = xn1;
+			xn1 = x0;
+			yn2 = yn1;
+			yn1 = y0;
+		}
+		_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+		for (int j = 0; j < 4; j++)
+			_mm_storeu_ps(&output[k + j][n], r[j]);
+	}
+	_mm_storeu_ps(&batch->xn1[k], xn1);
+	_mm_storeu_ps(&batch->xn2[k], xn2);
+	_mm_storeu_ps(&batch->yn1[k], yn1);
+	_mm_storeu_ps(&batch->yn2[k], yn2);
+	batch_range(batch, k, k + 4, tiled, size, input, output);
+}
+
+__attribute__((target("sse")))
+static void batch_sse(sf_biquad_batch_st *batch, int64_t size, const float *const *input,
+	float *const *output){
+	int full = batch->size & ~3;
+	for (int k = 0; k < full; k += 4)
+		batch_group_sse(batch, k, size, input, output);
+	batch_range(batch, full, batch->size, 0, size, input, output);
+}
+
+// the AVX version transposes the two halves of eight streams separately, then joins them, so each
+// register holds one sample of all eight streams
+
+// process streams `k` to `k + 7`
+__attribute__((target("avx")))
+static void batch_group_avx(sf_biquad_batch_st *batch, int k, int64_t size,
+	const float *const *input, float *const *output){
+	__m256 b0 = _mm256_set1_ps(batch->b0);
+	__m256 b1 = _mm256_set1_ps(batch->b1);
+	__m256 b2 = _mm256_set1_ps(batch->b2);
+	__m256 a1 = _mm256_set1_ps(batch->a1);
+	__m256 a2 = _mm256_set1_ps(batch->a2);
+	__m256 xn1 = _mm256_loadu_ps(&batch->xn1[k]);
+	__m256 xn2 = _mm256_loadu_ps(&batch->xn2[k]);
+	__m256 yn1 = _mm256_loadu_ps(&batch->yn1[k]);
+	__m256 yn2 = _mm256_loadu_ps(&batch->yn2[k]);
+	int64_t tiled = size & ~3;
+	for (int64_t n = 0; n < tiled; n += 4){
+		__m128 lo[4], hi[4];
+		for (int j = 0; j < 4; j++){
+			lo[j] = _mm_loadu_ps(&input[k + j][n]);
+			hi[j] = _mm_loadu_ps(&input[k + 4 + j][n]);
+		}
+		_MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+		_MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+		for (int j = 0; j < 4; j++){
+			__m256 x0 = _mm256_insertf128_ps(_mm256_castps128_ps256(lo[j]), hi[j], 1);
+			__m256 y0 = _mm256_sub_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(b0, x0), _mm256_mul_ps(b1, xn1)), _mm256_mul_ps(b2, xn2)),
+				_mm256_mul_ps(a1, yn1)), _mm256_mul_ps(a2, yn2));
+			lo[j] = _mm256_castps256_ps128(y0);
+			hi[j] = _mm256_extractf128_ps(y0, 1);
+			xn2 = xn1;
+			xn1 = x0;
+			yn2 = yn1;
+			yn1 = y0;
+		}
+		_MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+		_MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+		for (int j = 0; j < 4; j++){
+			_mm_storeu_ps(&output[k + j][n], lo[j]);
+			_mm_storeu_ps(&output[k + 4 + j][n], hi[j]);
+		}
+	}
+	_mm256_storeu_ps(&batch->xn1[k], xn1);
+	_mm256_storeu_ps(&batch->xn2[k], xn2);
+	_mm256_storeu_ps(&batch->yn1[k], yn1);
+	_mm256_storeu_ps(&batch->yn2[k], yn2);
+	batch_range(batch, k, k + 8, tiled, size, input, output);
+}
+
+__attribute__((target("avx")))
+static void batch_avx(sf_biquad_batch_st *batch, int64_t size, const float *const *input,
+	float *const *output){
+	int full = batch->size & ~7;
+	for (int k = 0; k < full; k += 8)
+		batch_group_avx(batch, k, size, input, output);
+	int k = full;
+	if (batch->size - k >= 4){
+		batch_group_sse(batch, k, size, input, output);
+		k += 4;
+	}
+	batch_range(batch, k, batch->size, 0, size, input, output);
+}
+
+#endif
+
+// run two biquads in a row over the input, as if with process_scalar(first, ...), followed by
+// process_scalar(second, ...) over the output of the first (size must be at least 1)
+//
+// the vector versions run the two biquads side by side in one register, with the second one a
+// sample behind the first: each step feeds x[n] to the first biquad, and the first biquad's output
+// from the step before to the second
+static void pair_scalar(sf_biquad_state_st *first, sf_biquad_state_st *second, int64_t size,
+	const sf_sample_st *input, sf_sample_st *output){
+	process_scalar(first, size, input, output);
+	process_scalar(second, size, output, output);
+}
+
+typedef void (*kernel_func)(sf_biquad_state_st *state, int64_t size, const sf_sample_st *input,
+	sf_sample_st *output);
+typedef void (*pair_func)(sf_biquad_state_st *first, sf_biquad_state_st *second, int64_t size,
+	const sf_sample_st *input, sf_sample_st *output);
+typedef void (*ramp_func)(sf_biquad_smooth_st *smooth, int64_t size, const sf_sample_st *input,
+	sf_sample_st *output);
+typedef void (*batch_func)(sf_biquad_batch_st *batch, int64_t size, const float *const *input,
+	float *const *output);
+
+typedef struct {
+	const char *name;       // the version sf_biquad_process uses
+	const char *batch_name; // the version sf_biquad_batch_process uses
+	kernel_func process;
+	pair_func pair;
+	ramp_func ramp;
+	batch_func batch;
+} kernels_st;
+
+static const kernels_st kernels_scalar = { "scalar", "scalar", process_scalar, pair_scalar,
+	ramp_scalar, batch_scalar };
+#if defined(KERNEL_SSE)
+static const kernels_st kernels_sse = { "sse", "sse", process_sse, pair_sse, ramp_sse,
+	batch_sse };
+// AVX only widens the batches; a single stream doesn't have eight lanes of work
+static const kernels_st kernels_avx = { "sse", "avx", process_sse, pair_sse, ramp_sse,
+	batch_avx };
+#endif
+
+// the versions picked for this machine, set on first use
+static const kernels_st *kernels = NULL;
+
+static const kernels_st *pick_kernels(){
+#if defined(KERNEL_SSE)
+	if (__builtin_cpu_supports("avx"))
+		return &kernels_avx;
+	if (__builtin_cpu_supports("sse"))
+		return &kernels_sse;
+	return &kernels_scalar;
+#else
+	return &kernels_scalar;
+#endif
+}
+
+static inline const kernels_st *get_kernels(){
+	// threads racing through here all pick the same versions, so it doesn't matter who stores them
+	const kernels_st *k = __atomic_load_n(&kernels, __ATOMIC_RELAXED);
+	if (k == NULL){
+		k = pick_kernels();
+		__atomic_store_n(&kernels, k, __ATOMIC_RELAXED);
+	}
+	return k;
+}
+
+// once a biquad has rung out to exactly zero (which flushing denormals makes sure of), silence in
+// gives silence out without changing the state, so the silence at the start of the input can be
+// skipped
+static inline bool state_silent(const sf_biquad_state_st *state){
+	return
+		state->xn1.L == 0 && state->xn1.R == 0 && state->xn2.L == 0 && state->xn2.R == 0 &&
+		state->yn1.L == 0 && state->yn1.R == 0 && state->yn2.L == 0 && state->yn2.R == 0;
+}
+
+// write the silence at the start of the input to the output, and return the number of samples
+static int64_t skip_silence(int64_t size, const sf_sample_st *input, sf_sample_st *output){
+	int64_t n = 0;
+	while (n < size && input[n].L == 0 && input[n].R == 0)
+		n++;
+	if (n > 0 && input != output)
+		memset(output, 0, sizeof(sf_sample_st) * n);
+	return n;
+}
+
+void sf_biquad_process(sf_biquad_state_st *state, int64_t size, sf_sample_st *input,
+	sf_sample_st *output){
+	if (state_silent(state)){
+		int64_t n = skip_silence(size, input, output);
+		input += n;
+		output += n;
+		size -= n;
+		if (size <= 0)
+			return;
+	}
+	sf_denormal_st dn;
+	sf_denormal_enter(&dn);
+	get_kernels()->process(state, size, input, output);
+	sf_denormal_leave(&dn);
+}
+
+const char *sf_biquad_kernel(){
+	return get_kernels()->name;
+}
+
+void sf_biquad_chain_init(sf_biquad_chain_st *chain){
+	chain->size = 0;
+}
+
+int sf_biquad_chain_add(sf_biquad_chain_st *chain, const sf_biquad_state_st *section){
+	if (chain->size >= SF_BIQUAD_CHAIN_MAX)
+		return -1;
+	chain->sections[chain->size] = *section;
+	return chain->size++;
+}
+
+bool sf_biquad_chain_remove(sf_biquad_chain_st *chain, int index){
+	if (index < 0 || index >= chain->size)
+		return false;
+	memmove(&chain->sections[index], &chain->sections[index + 1],
+		sizeof(sf_biquad_state_st) * (chain->size - index - 1));
+	chain->size--;
+	return true;
+}
+
+bool sf_biquad_chain_update(sf_biquad_chain_st *chain, int index,
+	const sf_biquad_state_st *section){
+	if (index < 0 || index >= chain->size)
+		return false;
+	sf_biquad_state_st *s = &chain->sections[index];
+	s->b0 = section->b0;
+	s->b1 = section->b1;
+	s->b2 = section->b2;
+	s->a1 = section->a1;
+	s->a2 = section->a2;
+	return true;
+}
+
+void sf_biquad_chain_process(sf_biquad_chain_st *chain, int64_t size, sf_sample_st *input,
+	sf_sample_st *output){
+	if (chain->size <= 0){
+		if (input != output)
+			memmove(output, input, sizeof(sf_sample_st) * size);
+		return;
+	}
+	bool silent = true;
+	for (int i = 0; i < chain->size && silent; i++)
+		silent = state_silent(&chain->sections[i]);
+	if (silent){
+		int64_t n = skip_silence(size, input, output);
+		input += n;
+		output += n;
+		size -= n;
+	}
+	sf_denormal_st dn;
+	sf_denormal_enter(&dn);
+	const kernels_st *k = get_kernels();
+	for (int64_t pos = 0; pos < size; pos += SF_BIQUAD_CHAIN_BLOCK){
+		int64_t n = size - pos < SF_BIQUAD_CHAIN_BLOCK ? size - pos : SF_BIQUAD_CHAIN_BLOCK;
+		// the first section reads the input, and the rest work on the output in place
+		const sf_sample_st *in = &input[pos];
+		sf_sample_st *out = &output[pos];
+		int i = 0;
+		for (; i + 1 < chain->size; i += 2, in = out)
+			k->pair(&chain->sections[i], &chain->sections[i + 1], n, in, out);
+		if (i < chain->size)
+			k->process(&chain->sections[i], n, in, out);
+	}
+	sf_denormal_leave(&dn);
+}
+
+bool sf_biquad_batch_init(sf_biquad_batch_st *batch, int streams,
+	const sf_biquad_state_st *design){
+	if (streams < 1 || streams > SF_BIQUAD_BATCH_MAX)
+		return false;
+	batch->size = streams;
+	sf_biquad_batch_update(batch, design);
+	for (int k = 0; k < SF_BIQUAD_BATCH_MAX; k++){
+		batch->xn1[k] = 0;
+		batch->xn2[k] = 0;
+		batch->yn1[k] = 0;
+		batch->yn2[k] = 0;
+	}
+	return true;
+}
+
+void sf_biquad_batch_update(sf_biquad_batch_st *batch, const sf_biquad_state_st *design){
+	batch->b0 = design->b0;
+	batch->b1 = design->b1;
+	batch->b2 = design->b2;
+	batch->a1 = design->a1;
+	batch->a2 = design->a2;
+}
+
+bool sf_biquad_batch_reset(sf_biquad_batch_st *batch, int stream){
+	if (stream < 0 || stream >= batch->size)
+		return false;
+	batch->xn1[stream] = 0;
+	batch->xn2[stream] = 0;
+	batch->yn1[stream] = 0;
+	batch->yn2[stream] = 0;
+	return true;
+}
+
+void sf_biquad_batch_process(sf_biquad_batch_st *batch, int64_t size, const float *const *input,
+	float *const *output){
+	sf_denormal_st dn;
+	sf_denormal_enter(&dn);
+	get_kernels()->batch(batch, size, input, output);
+	sf_denormal_leave(&dn);
+}
+
+const char *sf_biquad_batch_kernel(){
+	return get_kernels()->batch_name;
+}
+
+void sf_biquad_smooth_init(sf_biquad_smooth_st *smooth, const sf_biquad_state_st *design){
+	smooth->biquad = *design;
+	sf_biquad_smooth_target(smooth, design, 0);
+}
+
+void sf_biquad_smooth_target(sf_biquad_smooth_st *smooth, const sf_biquad_state_st *design,
+	int64_t samples){
+	sf_biquad_state_st *bq = &smooth->biquad;
+	smooth->b0 = design->b0;
+	smooth->b1 = design->b1;
+	smooth->b2 = design->b2;
+	smooth->a1 = design->a1;
+	smooth->a2 = design->a2;
+	if (samples <= 0){
+		bq->b0 = design->b0;
+		bq->b1 = design->b1;
+		bq->b2 = design->b2;
+		bq->a1 = design->a1;
+		bq->a2 = design->a2;
+		smooth->db0 = smooth->db1 = smooth->db2 = smooth->da1 = smooth->da2 = 0;
+		smooth->ramp = 0;
+		return;
+	}
+	float inv = 1.0f / (float)samples;
+	smooth->db0 = (design->b0 - bq->b0) * inv;
+	smooth->db1 = (design->b1 - bq->b1) * inv;
+	smooth->db2 = (design->b2 - bq->b2) * inv;
+	smooth->da1 = (design->a1 - bq->a1) * inv;
+	smooth->da2 = (design->a2 - bq->a2) * inv;
+	smooth->ramp = samples;
+}
+
+void sf_biquad_smooth_process(sf_biquad_smooth_st *smooth, int64_t size, sf_sample_st *input,
+	sf_sample_st *output){
+	int64_t n = smooth->ramp < size ? smooth->ramp : size;
+	if (n > 0){
+		sf_denormal_st dn;
+		sf_denormal_enter(&dn);
+		get_kernels()->ramp(smooth, n, input, output);
+		sf_denormal_leave(&dn);
+		smooth->ramp -= n;
+		if (smooth->ramp == 0){
+			// land exactly on the target, instead of wherever the rounding in the steps ended up
+			sf_biquad_state_st *bq = &smooth->biquad;
+			bq->b0 = smooth->b0;
+			bq->b1 = smooth->b1;
+			bq->b2 = smooth->b2;
+			bq->a1 = smooth->a1;
+			bq->a2 = smooth->a2;
+		}
+	}
+	if (n < size)
+		sf_biquad_process(&smooth->biquad, size - n, &input[n], &output[n]);
+}
+
+// run the biquad over a single contiguous channel, carrying the channel's history in and out
+static inline void process_channel(const sf_biquad_state_st *state, int64_t size,
+	const float *input, float *output, float *xn1, float *xn2, float *yn1, float *yn2){
+	float b0 = state->b0;
+	float b1 = state->b1;
+	float b2 = state->b2;
+	float a1 = state->a1;
+	float a2 = state->a2;
+	float x1 = *xn1, x2 = *xn2, y1 = *yn1, y2 = *yn2;
+	for (int64_t n = 0; n < size; n++){
+		float x0 = input[n];
+		float y0 =
+			b0 * x0 +
+			b1 * x1 +
+			b2 * x2 -
+			a1 * y1 -
+			a2 * y2;
+		y0 = sf_denormal_flush(y0);
+		output[n] = y0;
+		x2 = x1;
+		x1 = x0;
+		y2 = y1;
+		y1 = y0;
+	}
+	*xn1 = x1;
+	*xn2 = x2;
+	*yn1 = y1;
+	*yn2 = y2;
+}
+
+// the channels don't interact, so with planar buffers each one is filtered in its own pass
+void sf_biquad_process_planar(sf_biquad_state_st *state, int64_t size, const float *inputL,
+	const float *inputR, float *outputL, float *outputR){
+	sf_denormal_st dn;
+	sf_denormal_enter(&dn);
+	process_channel(state, size, inputL, outputL,
+		&state->xn1.L, &state->xn2.L, &state->yn1.L, &state->yn2.L);
+	process_channel(state, size, inputR, outputR,
+		&state->xn1.R, &state->xn2.R, &state->yn1.R, &state->yn2.R);
+	sf_denormal_leave(&dn);
+}
+
 // each type of filter just has some magic math to setup the coefficients
 //
 // the math is quite complicated to understand, but the *implementation* is quite simple
@@ -104,8 +802,7 @@ static inline void state_zero(sf_biquad_state_st *state){
 }
 
 // initialize the biquad state to be a lowpass filter
-void sf_lowpass(sf_biquad_state_st *state, int rate, float cutoff, float resonance){
-	state_reset(state);
+static void design_lowpass(sf_biquad_state_st *state, int rate, float cutoff, float resonance){
 	float nyquist = rate * 0.5f;
 	cutoff /= nyquist;
 
@@ -128,8 +825,7 @@ void sf_lowpass(sf_biquad_state_st *state, int rate, float cutoff, float resonan
 	}
 }
 
-void sf_highpass(sf_biquad_state_st *state, int rate, float cutoff, float resonance){
-	state_reset(state);
+static void design_highpass(sf_biquad_state_st *state, int rate, float cutoff, float resonance){
 	float nyquist = rate * 0.5f;
 	cutoff /= nyquist;
 
@@ -152,8 +848,7 @@ void sf_highpass(sf_biquad_state_st *state, int rate, float cutoff, float resona
 	}
 }
 
-void sf_bandpass(sf_biquad_state_st *state, int rate, float freq, float Q){
-	state_reset(state);
+static void design_bandpass(sf_biquad_state_st *state, int rate, float freq, float Q){
 	float nyquist = rate * 0.5f;
 	freq /= nyquist;
 
@@ -174,8 +869,7 @@ void sf_bandpass(sf_biquad_state_st *state, int rate, float freq, float Q){
 	}
 }
 
-void sf_notch(sf_biquad_state_st *state, int rate, float freq, float Q){
-	state_reset(state);
+static void design_notch(sf_biquad_state_st *state, int rate, float freq, float Q){
 	float nyquist = rate * 0.5f;
 	freq /= nyquist;
 
@@ -196,8 +890,7 @@ void sf_notch(sf_biquad_state_st *state, int rate, float freq, float Q){
 	}
 }
 
-void sf_peaking(sf_biquad_state_st *state, int rate, float freq, float Q, float gain){
-	state_reset(state);
+static void design_peaking(sf_biquad_state_st *state, int rate, float freq, float Q, float gain){
 	float nyquist = rate * 0.5f;
 	freq /= nyquist;
 
@@ -224,8 +917,7 @@ void sf_peaking(sf_biquad_state_st *state, int rate, float freq, float Q, float
 	state->a2 = a0inv * (1.0f - alpha / A);
 }
 
-void sf_allpass(sf_biquad_state_st *state, int rate, float freq, float Q){
-	state_reset(state);
+static void design_allpass(sf_biquad_state_st *state, int rate, float freq, float Q){
 	float nyquist = rate * 0.5f;
 	freq /= nyquist;
 
@@ -247,8 +939,7 @@ void sf_allpass(sf_biquad_state_st *state, int rate, float freq, float Q){
 }
 
 // WebAudio hardcodes Q=1
-void sf_lowshelf(sf_biquad_state_st *state, int rate, float freq, float Q, float gain){
-	state_reset(state);
+static void design_lowshelf(sf_biquad_state_st *state, int rate, float freq, float Q, float gain){
 	float nyquist = rate * 0.5f;
 	freq /= nyquist;
 
@@ -282,8 +973,7 @@ void sf_lowshelf(sf_biquad_state_st *state, int rate, float freq, float Q, float
 }
 
 // WebAudio hardcodes Q=1
-void sf_highshelf(sf_biquad_state_st *state, int rate, float freq, float Q, float gain){
-	state_reset(state);
+static void design_highshelf(sf_biquad_state_st *state, int rate, float freq, float Q, float gain){
 	float nyquist = rate * 0.5f;
 	freq /= nyquist;
 
@@ -315,3 +1005,216 @@ void sf_highshelf(sf_biquad_state_st *state, int rate, float freq, float Q, floa
 	state->a1 = a0inv * 2.0f * (Am1 - Ap1 * k);
 	state->a2 = a0inv * (Ap1 - Am1 * k - k2);
 }
+
+//
+// design cache
+//
+
+typedef enum {
+	DESIGN_NONE, // empty cache slot
+	DESIGN_LOWPASS,
+	DESIGN_HIGHPASS,
+	DESIGN_BANDPASS,
+	DESIGN_NOTCH,
+	DESIGN_PEAKING,
+	DESIGN_ALLPASS,
+	DESIGN_LOWSHELF,
+	DESIGN_HIGHSHELF
+} design_type;
+
+// the key is the type, rate, and the bits of each parameter, so a hit returns exactly what the math
+// would
+#define KEY_WORDS  5
+
+static inline uint32_t float_bits(float f){
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+static inline float bits_float(uint32_t u){
+	float f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+#if SF_BIQUAD_CACHE_SIZE > 0
+
+// each slot is a seqlock: a writer makes `seq` odd, writes the slot, and makes it even again, and a
+// reader copies the slot and only trusts the copy if `seq` was the same even number before and
+// after; readers never write, and a writer that finds a slot busy skips it instead of waiting, so
+// designing never blocks
+typedef struct {
+	uint32_t seq;
+	uint32_t key[KEY_WORDS];
+	uint32_t coeff[5]; // b0, b1, b2, a1, a2
+} cache_slot_st;
+
+static cache_slot_st cache[SF_BIQUAD_CACHE_SIZE];
+
+// the counters are bumped with a plain load and store, since an atomic add on every design costs
+// about as much as a hit; threads racing on them can lose a count now and then (they only exist
+// with the cache, so designing without it never touches shared memory)
+static int64_t cache_hits = 0;
+static int64_t cache_misses = 0;
+
+static inline void count(int64_t *counter){
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+static inline cache_slot_st *cache_slot(const uint32_t *key){
+	const uint64_t K = 0x9E3779B97F4A7C15ULL;
+	uint64_t h = 0;
+	for (int i = 0; i < KEY_WORDS; i++)
+		h = (h ^ key[i]) * K;
+	return &cache[(h >> 32) % SF_BIQUAD_CACHE_SIZE];
+}
+
+static bool cache_get(const uint32_t *key, sf_biquad_state_st *state){
+	cache_slot_st *slot = cache_slot(key);
+	uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	if (seq & 1)
+		return false;
+	uint32_t skey[KEY_WORDS], coeff[5];
+	for (int i = 0; i < KEY_WORDS; i++)
+		skey[i] = __atomic_load_n(&slot->key[i], __ATOMIC_RELAXED);
+	for (int i = 0; i < 5; i++)
+		coeff[i] = __atomic_load_n(&slot->coeff[i], __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+		return false;
+	if (memcmp(skey, key, sizeof(skey)) != 0)
+		return false;
+	state->b0 = bits_float(coeff[0]);
+	state->b1 = bits_float(coeff[1]);
+	state->b2 = bits_float(coeff[2]);
+	state->a1 = bits_float(coeff[3]);
+	state->a2 = bits_float(coeff[4]);
+	count(&cache_hits);
+	return true;
+}
+
+// make the slot's `seq` odd, returning false if someone else is writing to it
+static inline bool slot_begin(cache_slot_st *slot, uint32_t *seq){
+	*seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+	if ((*seq & 1) || !__atomic_compare_exchange_n(&slot->seq, seq, *seq + 1, false,
+		__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		return false;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return true;
+}
+
+static inline void slot_end(cache_slot_st *slot, uint32_t seq){
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// called after every miss
+static void cache_put(const uint32_t *key, const sf_biquad_state_st *state){
+	count(&cache_misses);
+	cache_slot_st *slot = cache_slot(key);
+	uint32_t seq;
+	if (!slot_begin(slot, &seq))
+		return;
+	for (int i = 0; i < KEY_WORDS; i++)
+		__atomic_store_n(&slot->key[i], key[i], __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->coeff[0], float_bits(state->b0), __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->coeff[1], float_bits(state->b1), __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->coeff[2], float_bits(state->b2), __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->coeff[3], float_bits(state->a1), __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->coeff[4], float_bits(state->a2), __ATOMIC_RELAXED);
+	slot_end(slot, seq);
+}
+
+void sf_biquad_cache_clear(){
+	for (int i = 0; i < SF_BIQUAD_CACHE_SIZE; i++){
+		cache_slot_st *slot = &cache[i];
+		uint32_t seq;
+		while (!slot_begin(slot, &seq))
+			;
+		// no key has a type of DESIGN_NONE
+		__atomic_store_n(&slot->key[0], (uint32_t)DESIGN_NONE, __ATOMIC_RELAXED);
+		slot_end(slot, seq);
+	}
+	__atomic_store_n(&cache_hits, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cache_misses, 0, __ATOMIC_RELAXED);
+}
+
+void sf_biquad_cache_getstats(sf_biquad_cache_stats_st *stats){
+	stats->hits = __atomic_load_n(&cache_hits, __ATOMIC_RELAXED);
+	stats->misses = __atomic_load_n(&cache_misses, __ATOMIC_RELAXED);
+}
+
+#else
+
+static inline bool cache_get(const uint32_t *, sf_biquad_state_st *){
+	return false;
+}
+
+static inline void cache_put(const uint32_t *, const sf_biquad_state_st *){
+}
+
+void sf_biquad_cache_clear(){
+}
+
+void sf_biquad_cache_getstats(sf_biquad_cache_stats_st *stats){
+	stats->hits = 0;
+	stats->misses = 0;
+}
+
+#endif
+
+// clear the state, and set the coefficients from the cache, or from the math on a miss
+// `p1` is the frequency, `p2` the Q (or resonance), and `p3` the gain, if the filter has one
+static void design(sf_biquad_state_st *state, design_type type, int rate, float p1, float p2,
+	float p3){
+	state_reset(state);
+	uint32_t key[KEY_WORDS] = {
+		(uint32_t)type, (uint32_t)rate, float_bits(p1), float_bits(p2), float_bits(p3)
+	};
+	if (cache_get(key, state))
+		return;
+	switch (type){
+		case DESIGN_NONE     :                                            break;
+		case DESIGN_LOWPASS  : design_lowpass  (state, rate, p1, p2);     break;
+		case DESIGN_HIGHPASS : design_highpass (state, rate, p1, p2);     break;
+		case DESIGN_BANDPASS : design_bandpass (state, rate, p1, p2);     break;
+		case DESIGN_NOTCH    : design_notch    (state, rate, p1, p2);     break;
+		case DESIGN_PEAKING  : design_peaking  (state, rate, p1, p2, p3); break;
+		case DESIGN_ALLPASS  : design_allpass  (state, rate, p1, p2);     break;
+		case DESIGN_LOWSHELF : design_lowshelf (state, rate, p1, p2, p3); break;
+		case DESIGN_HIGHSHELF: design_highshelf(state, rate, p1, p2, p3); break;
+	}
+	cache_put(key, state);
+}
+
+void sf_lowpass(sf_biquad_state_st *state, int rate, float cutoff, float resonance){
+	design(state, DESIGN_LOWPASS, rate, cutoff, resonance, 0);
+}
+
+void sf_highpass(sf_biquad_state_st *state, int rate, float cutoff, float resonance){
+	design(state, DESIGN_HIGHPASS, rate, cutoff, resonance, 0);
+}
+
+void sf_bandpass(sf_biquad_state_st *state, int rate, float freq, float Q){
+	design(state, DESIGN_BANDPASS, rate, freq, Q, 0);
+}
+
+void sf_notch(sf_biquad_state_st *state, int rate, float freq, float Q){
+	design(state, DESIGN_NOTCH, rate, freq, Q, 0);
+}
+
+void sf_peaking(sf_biquad_state_st *state, int rate, float freq, float Q, float gain){
+	design(state, DESIGN_PEAKING, rate, freq, Q, gain);
+}
+
+void sf_allpass(sf_biquad_state_st *state, int rate, float freq, float Q){
+	design(state, DESIGN_ALLPASS, rate, freq, Q, 0);
+}
+
+void sf_lowshelf(sf_biquad_state_st *state, int rate, float freq, float Q, float gain){
+	design(state, DESIGN_LOWSHELF, rate, freq, Q, gain);
+}
+
+void sf_highshelf(sf_biquad_state_st *state, int rate, float freq, float Q, float gain){
+	design(state, DESIGN_HIGHSHELF, rate, freq, Q, gain);
+}
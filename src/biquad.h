@@ -31,6 +31,24 @@
 //
 // also notice that the choice to divide the sound into chunks of 128 samples is completely
 // arbitrary from the filter's perspective
+//
+// the output can be the same buffer as the input, to filter the sound in place:
+//
+//     sf_biquad_process(&lowpass, 128, samples, samples);
+//
+// the process functions flush denormals to zero while they run (see denormal.h), so a filter
+// doesn't slow down as it rings out; once it has rung out to exactly zero, silence at the start of
+// the input is copied straight to the output
+
+// sf_biquad_process filters both channels of two samples at a time in one SIMD register, using
+// SSE on x86 when the CPU supports it (checked once, on the first call); everywhere else, and with
+// SF_BIQUAD_SIMD set to 0, it uses plain C
+//
+// every version does the same operations in the same order, so the results only differ where the
+// compiler fuses multiplies and adds differently (on x86, they're identical)
+#ifndef SF_BIQUAD_SIMD
+#	define SF_BIQUAD_SIMD  1
+#endif
 
 typedef struct {
 	float b0;
@@ -55,8 +73,236 @@ void sf_lowshelf (sf_biquad_state_st *state, int rate, float freq, float Q, floa
 void sf_highshelf(sf_biquad_state_st *state, int rate, float freq, float Q, float gain);
 
 // this function will process the input sound based on the state passed
-// the input and output buffers should be the same size
-void sf_biquad_process(sf_biquad_state_st *state, int size, sf_sample_st *input,
+// the input and output buffers should be the same size, and can be the same buffer (but shouldn't
+// otherwise overlap)
+void sf_biquad_process(sf_biquad_state_st *state, int64_t size, sf_sample_st *input,
+	sf_sample_st *output);
+
+// same as above, but with each channel in its own buffer (see sf_psnd in snd.h)
+void sf_biquad_process_planar(sf_biquad_state_st *state, int64_t size, const float *inputL,
+	const float *inputR, float *outputL, float *outputR);
+
+// name of the version sf_biquad_process uses on this machine: "sse" or "scalar"
+const char *sf_biquad_kernel();
+
+//
+// chains
+//
+
+// a chain runs a sound through several biquads in a row, like the sections of an EQ
+//
+// running sf_biquad_process once per biquad streams the whole buffer through memory once per
+// biquad; a chain runs each block of SF_BIQUAD_CHAIN_BLOCK samples through all of the biquads
+// while the block is still in the cache, and with SIMD, runs two biquads at a time side by side
+//
+// for example, a three band EQ:
+//
+//   sf_biquad_chain_st eq;
+//   sf_biquad_chain_init(&eq);
+//   sf_biquad_state_st section;
+//   sf_lowshelf(&section, 44100, 200, 1, 3);
+//   int bass = sf_biquad_chain_add(&eq, &section);
+//   sf_peaking(&section, 44100, 1000, 1, -2);
+//   int mid = sf_biquad_chain_add(&eq, &section);
+//   sf_highshelf(&section, 44100, 6000, 1, 4);
+//   int treble = sf_biquad_chain_add(&eq, &section);
+//
+//   for each 128 length sample:
+//     sf_biquad_chain_process(&eq, 128, input, output);
+//
+//   // turn the bass up, without disturbing the state of any section
+//   sf_lowshelf(&section, 44100, 200, 1, 6);
+//   sf_biquad_chain_update(&eq, bass, &section);
+//
+// the output is the same as running sf_biquad_process with each section in turn
+
+// maximum number of sections in a chain
+#ifndef SF_BIQUAD_CHAIN_MAX
+#	define SF_BIQUAD_CHAIN_MAX  16
+#endif
+
+// number of samples run through all of the sections at a time
+#ifndef SF_BIQUAD_CHAIN_BLOCK
+#	define SF_BIQUAD_CHAIN_BLOCK  256
+#endif
+
+typedef struct {
+	int size; // number of sections
+	sf_biquad_state_st sections[SF_BIQUAD_CHAIN_MAX];
+} sf_biquad_chain_st;
+
+// initialize an empty chain, which passes the input through as is
+void sf_biquad_chain_init(sf_biquad_chain_st *chain);
+
+// add a copy of `section` (coefficients and state) to the end of the chain, and return its index
+// (returns -1 if the chain is full)
+int sf_biquad_chain_add(sf_biquad_chain_st *chain, const sf_biquad_state_st *section);
+
+// remove the section at `index`; the sections after it move down one index, and keep their state
+// (returns false if there isn't a section at `index`)
+bool sf_biquad_chain_remove(sf_biquad_chain_st *chain, int index);
+
+// replace the coefficients of the section at `index` with the ones in `section`, keeping the state
+// of the section so the sound carries on without a reset
+// (returns false if there isn't a section at `index`)
+bool sf_biquad_chain_update(sf_biquad_chain_st *chain, int index,
+	const sf_biquad_state_st *section);
+
+// process the input sound through every section of the chain
+// the input and output buffers should be the same size, and can be the same buffer (but shouldn't
+// otherwise overlap)
+void sf_biquad_chain_process(sf_biquad_chain_st *chain, int64_t size, sf_sample_st *input,
 	sf_sample_st *output);
 
+//
+// batches
+//
+
+// a batch runs the same biquad over many independent mono streams, like one filter applied to
+// every voice of a synth, or to every channel of a multichannel file
+//
+// a single stream can't go faster than one sample at a time, since every output depends on the one
+// before it; but separate streams don't depend on each other, so with SIMD a batch puts one stream
+// in each lane of a register and filters four streams per instruction (eight with AVX), and the
+// throughput grows with the width of the vector instead of the number of streams
+//
+// for example, one lowpass over 8 voices:
+//
+//   sf_biquad_state_st lowpass;
+//   sf_lowpass(&lowpass, 44100, 440, 1);
+//   sf_biquad_batch_st voices;
+//   sf_biquad_batch_init(&voices, 8, &lowpass);
+//
+//   for each 128 length sample:
+//     // input[k] and output[k] are the 128 samples of voice k
+//     sf_biquad_batch_process(&voices, 128, input, output);
+//
+// the output of each stream is the same as running it through its own copy of the biquad
+
+// maximum number of streams in a batch
+#ifndef SF_BIQUAD_BATCH_MAX
+#	define SF_BIQUAD_BATCH_MAX  16
+#endif
+
+typedef struct {
+	float b0;
+	float b1;
+	float b2;
+	float a1;
+	float a2;
+	int size; // number of streams
+	// state of each stream; the entries past `size` stay zero
+	float xn1[SF_BIQUAD_BATCH_MAX];
+	float xn2[SF_BIQUAD_BATCH_MAX];
+	float yn1[SF_BIQUAD_BATCH_MAX];
+	float yn2[SF_BIQUAD_BATCH_MAX];
+} sf_biquad_batch_st;
+
+// initialize a batch of `streams` streams, all using the coefficients in `design`, with cleared
+// state (returns false if `streams` isn't between 1 and SF_BIQUAD_BATCH_MAX)
+bool sf_biquad_batch_init(sf_biquad_batch_st *batch, int streams,
+	const sf_biquad_state_st *design);
+
+// replace the coefficients of every stream with the ones in `design`, keeping the state
+void sf_biquad_batch_update(sf_biquad_batch_st *batch, const sf_biquad_state_st *design);
+
+// clear the state of one stream, so it starts over (returns false if there isn't a stream at
+// `stream`)
+bool sf_biquad_batch_reset(sf_biquad_batch_st *batch, int stream);
+
+// process `size` samples of every stream, reading stream k from `input[k]` and writing it to
+// `output[k]`
+// each output buffer can be the same as its input buffer (but shouldn't otherwise overlap any of
+// the buffers)
+void sf_biquad_batch_process(sf_biquad_batch_st *batch, int64_t size, const float *const *input,
+	float *const *output);
+
+// name of the version sf_biquad_batch_process uses on this machine: "avx", "sse", or "scalar"
+// (batches use AVX where it's there, since they have eight lanes of work)
+const char *sf_biquad_batch_kernel();
+
+//
+// automation
+//
+
+// calling sf_lowpass (etc) again to move a filter clears its state, which clicks, and jumps to the
+// new coefficients at a block boundary, which zippers; a smoothed biquad instead ramps its
+// coefficients toward a target design one sample at a time, while keeping its state
+//
+// the design math still runs once per target, but only additions run per sample, and once the
+// ramp is over the biquad is processed with the same kernels as sf_biquad_process
+//
+// for example, to sweep a lowpass, retargeting once per block:
+//
+//   sf_biquad_state_st design;
+//   sf_lowpass(&design, 44100, 200, 1);
+//   sf_biquad_smooth_st sweep;
+//   sf_biquad_smooth_init(&sweep, &design);
+//
+//   for each 128 length sample:
+//     sf_lowpass(&design, 44100, cutoff, 1);
+//     sf_biquad_smooth_target(&sweep, &design, 128);
+//     sf_biquad_smooth_process(&sweep, 128, input, output);
+//
+// the ramp is linear in the coefficients; every stable biquad has its a1,a2 inside the same
+// triangle, so each step between two stable designs is stable as well
+
+typedef struct {
+	sf_biquad_state_st biquad; // coefficients in use, and the state of the filter
+	// coefficients at the end of the ramp
+	float b0;
+	float b1;
+	float b2;
+	float a1;
+	float a2;
+	// amount added to the coefficients each sample during the ramp
+	float db0;
+	float db1;
+	float db2;
+	float da1;
+	float da2;
+	int64_t ramp; // samples left in the ramp
+} sf_biquad_smooth_st;
+
+// initialize a smoothed biquad with the coefficients and state of `design`, and no ramp
+void sf_biquad_smooth_init(sf_biquad_smooth_st *smooth, const sf_biquad_state_st *design);
+
+// ramp from the coefficients in use now to the ones in `design` over the next `samples` samples
+// (0 to switch right away); the state of `design` is ignored, and a ramp already in progress is
+// replaced, starting from wherever it got to
+void sf_biquad_smooth_target(sf_biquad_smooth_st *smooth, const sf_biquad_state_st *design,
+	int64_t samples);
+
+// process the input sound, moving the coefficients along the ramp
+// the input and output buffers should be the same size, and can be the same buffer (but shouldn't
+// otherwise overlap)
+void sf_biquad_smooth_process(sf_biquad_smooth_st *smooth, int64_t size, sf_sample_st *input,
+	sf_sample_st *output);
+
+//
+// design cache
+//
+
+// with SF_BIQUAD_CACHE_SIZE set above 0, the functions that design filters (sf_lowpass, etc)
+// remember the coefficients of up to that many designs, so asking for the same filter again (same
+// type, rate, and parameters) skips the trigonometry
+//
+// the cache is safe to use from multiple threads, and a hit gives exactly the same coefficients the
+// math would; it's off by default since it only pays off where the math is slow (software floating
+// point, or a slow libm), and with glibc on x86, a design takes about as long as a cache hit
+#ifndef SF_BIQUAD_CACHE_SIZE
+#	define SF_BIQUAD_CACHE_SIZE  0
+#endif
+
+typedef struct {
+	int64_t hits;   // designs copied out of the cache
+	int64_t misses; // designs calculated (both stay 0 when the cache is off)
+} sf_biquad_cache_stats_st;
+
+// the counters are approximate when multiple threads are designing filters at the same time
+void sf_biquad_cache_getstats(sf_biquad_cache_stats_st *stats);
+
+// forget every design in the cache, and zero the counters
+void sf_biquad_cache_clear();
+
 #endif // SNDFILTER_BIQUAD__H
@@ -6,6 +6,8 @@
 //
 
 #include "compressor.h"
+#include "denormal.h"
+#include "mem.h"
 #include <math.h>
 #include <string.h>
 
@@ -77,19 +79,27 @@ static inline float compcurve(float x, float k, float slope, float linearthresho
 	return db2lin(kneedboffset + slope * (lin2db(x) - threshold - knee));
 }
 
+// number of samples of predelay, between 1 and `max`
+static inline int delaysamples(int rate, float predelay, int max){
+	int delay = rate * predelay;
+	if (delay > max)
+		delay = max;
+	if (delay < 1)
+		delay = 1;
+	return delay;
+}
+
 // this is the main initialization function
 // it does a bunch of pre-calculation so that the inner loop of signal processing is fast
-void sf_advancecomp(sf_compressor_state_st *state, int rate, float pregain, float threshold,
-	float knee, float ratio, float attack, float release, float predelay, float releasezone1,
-	float releasezone2, float releasezone3, float releasezone4, float postgain, float wet){
+//
+// `state->delaybuf` must have room for `delaybufsize` samples, which must be at least `delay`
+static void advancecomp(sf_compressor_state_st *state, int delay, int delaybufsize, int rate,
+	float pregain, float threshold, float knee, float ratio, float attack, float release,
+	float releasezone1, float releasezone2, float releasezone3, float releasezone4, float postgain,
+	float wet){
 
 	// setup the predelay buffer
-	int delaybufsize = rate * predelay;
-	if (delaybufsize < 1)
-		delaybufsize = 1;
-	else if (delaybufsize > SF_COMPRESSOR_MAXDELAY)
-		delaybufsize = SF_COMPRESSOR_MAXDELAY;
-        memset(state->delaybuf, 0, sizeof(sf_sample_st) * delaybufsize);
+	memset(state->delaybuf, 0, sizeof(sf_sample_st) * delaybufsize);
 
 	// useful values
 	float linearpregain = db2lin(pregain);
@@ -168,8 +178,51 @@ void sf_advancecomp(sf_compressor_state_st *state, int rate, float pregain, floa
 	state->compgain             = 1.0f;
 	state->maxcompdiffdb        = -1.0f;
 	state->delaybufsize         = delaybufsize;
+	state->delaymask            = (delaybufsize & (delaybufsize - 1)) == 0 ? delaybufsize - 1 : 0;
 	state->delaywritepos        = 0;
-	state->delayreadpos         = delaybufsize > 1 ? 1 : 0;
+	state->delayreadpos         = (delaybufsize - delay + 1) % delaybufsize;
+	state->quiet                = 0;
+	state->settled              = false;
+}
+
+void sf_advancecomp(sf_compressor_state_st *state, int rate, float pregain, float threshold,
+	float knee, float ratio, float attack, float release, float predelay, float releasezone1,
+	float releasezone2, float releasezone3, float releasezone4, float postgain, float wet){
+	int delay = delaysamples(rate, predelay, SF_COMPRESSOR_MAXDELAY);
+	advancecomp(state, delay, delay, rate, pregain, threshold, knee, ratio, attack, release,
+		releasezone1, releasezone2, releasezone3, releasezone4, postgain, wet);
+	state->full = true;
+}
+
+sf_compressor_state_st *sf_compressor_newadvance(int rate, float pregain, float threshold,
+	float knee, float ratio, float attack, float release, float predelay, float releasezone1,
+	float releasezone2, float releasezone3, float releasezone4, float postgain, float wet,
+	bool pow2){
+	int delay = delaysamples(rate, predelay, rate > 1 ? rate : 1);
+	int delaybufsize = delay;
+	if (pow2){
+		delaybufsize = 1;
+		while (delaybufsize < delay)
+			delaybufsize *= 2;
+	}
+	sf_compressor_state_st *state = (sf_compressor_state_st *)sf_aligned_malloc(
+		offsetof(sf_compressor_state_st, delaybuf) + sizeof(sf_sample_st) * delaybufsize, SF_ALIGN);
+	if (state == NULL)
+		return NULL;
+	advancecomp(state, delay, delaybufsize, rate, pregain, threshold, knee, ratio, attack,
+		release, releasezone1, releasezone2, releasezone3, releasezone4, postgain, wet);
+	state->full = false;
+	return state;
+}
+
+void sf_compressor_free(sf_compressor_state_st *state){
+	sf_aligned_free(state);
+}
+
+size_t sf_compressor_memsize(sf_compressor_state_st *state){
+	if (state->full)
+		return sizeof(sf_compressor_state_st);
+	return offsetof(sf_compressor_state_st, delaybuf) + sizeof(sf_sample_st) * state->delaybufsize;
 }
 
 // for more information on the adaptive release curve, check out adaptive-release-curve.html demo +
@@ -195,8 +248,15 @@ static inline float fixf(float v, float def){
 	return v;
 }
 
-void sf_compressor_process(sf_compressor_state_st *state, int size, sf_sample_st *input,
-	sf_sample_st *output){
+// advance a position in the predelay ring
+static inline int delaynext(int pos, int size, int mask){
+	return mask ? (pos + 1) & mask : (pos + 1) % size;
+}
+
+// the compressor core reads and writes the channels through pointers and a stride, so the same code
+// serves both the interleaved (stride 2) and planar (stride 1) entry points
+static inline void compressor_process(sf_compressor_state_st *state, int64_t size,
+	const float *inL, const float *inR, float *outL, float *outR, int stride){
 
 	// pull out the state into local variables
 	float metergain            = state->metergain;
@@ -222,18 +282,53 @@ void sf_compressor_process(sf_compressor_state_st *state, int size, sf_sample_st
 	float compgain             = state->compgain;
 	float maxcompdiffdb        = state->maxcompdiffdb;
 	int delaybufsize           = state->delaybufsize;
+	int delaymask              = state->delaymask;
 	int delaywritepos          = state->delaywritepos;
 	int delayreadpos           = state->delayreadpos;
+	int quiet                  = state->quiet;
+	bool settled               = state->settled;
 	sf_sample_st *delaybuf     = state->delaybuf;
 
 	int samplesperchunk = SF_COMPRESSOR_SPU;
-	int chunks = size / samplesperchunk;
+	int64_t chunks = size / samplesperchunk;
 	float ang90 = (float)M_PI * 0.5f;
 	float ang90inv = 2.0f / (float)M_PI;
-	int samplepos = 0;
+	int64_t samplepos = 0;
 	float spacingdb = SF_COMPRESSOR_SPACINGDB;
 
-	for (int ch = 0; ch < chunks; ch++){
+	sf_denormal_st dn;
+	sf_denormal_enter(&dn);
+
+	for (int64_t ch = 0; ch < chunks; ch++){
+		// once the predelay ring only holds silence, and a chunk of silence leaves the envelope
+		// where it was, every following chunk of silence does exactly the same thing, so it can
+		// just be written out
+		bool silent = true;
+		for (int chi = 0; chi < samplesperchunk && silent; chi++){
+			int64_t p = (samplepos + chi) * stride;
+			silent = inL[p] == 0 && inR[p] == 0;
+		}
+		if (!silent){
+			quiet = 0;
+			settled = false;
+		}
+		else if (settled){
+			for (int chi = 0; chi < samplesperchunk; chi++, samplepos++){
+				outL[samplepos * stride] = 0;
+				outR[samplepos * stride] = 0;
+			}
+			continue;
+		}
+		else{
+			quiet += samplesperchunk;
+			if (quiet > delaybufsize)
+				quiet = delaybufsize;
+		}
+		float lastdetectoravg = detectoravg;
+		float lastcompgain = compgain;
+		float lastmaxcompdiffdb = maxcompdiffdb;
+		float lastmetergain = metergain;
+
 		detectoravg = fixf(detectoravg, 1.0f);
 		float desiredgain = detectoravg;
 		float scaleddesiredgain = asinf(desiredgain) * ang90inv;
@@ -262,11 +357,13 @@ void sf_compressor_process(sf_compressor_state_st *state, int size, sf_sample_st
 
 		// process the chunk
 		for (int chi = 0; chi < samplesperchunk; chi++, samplepos++,
-			delayreadpos = (delayreadpos + 1) % delaybufsize,
-			delaywritepos = (delaywritepos + 1) % delaybufsize){
+			delayreadpos = delaynext(delayreadpos, delaybufsize, delaymask),
+			delaywritepos = delaynext(delaywritepos, delaybufsize, delaymask)){
 
-			float inputL = input[samplepos].L * linearpregain;
-			float inputR = input[samplepos].R * linearpregain;
+			// the input sample goes into the delay buffer before the output sample at the same
+			// position is written, so the output can be the input buffer
+			float inputL = inL[samplepos * stride] * linearpregain;
+			float inputR = inR[samplepos * stride] * linearpregain;
 			delaybuf[delaywritepos] = (sf_sample_st){ .L = inputL, .R = inputR };
 
 			inputL = absf(inputL);
@@ -318,17 +415,33 @@ void sf_compressor_process(sf_compressor_state_st *state, int size, sf_sample_st
 				metergain += (premixgaindb - metergain) * meterrelease; // fall slowly
 
 			// apply the gain
-			output[samplepos] = (sf_sample_st){
-				.L = delaybuf[delayreadpos].L * gain,
-				.R = delaybuf[delayreadpos].R * gain
-			};
+			outL[samplepos * stride] = delaybuf[delayreadpos].L * gain;
+			outR[samplepos * stride] = delaybuf[delayreadpos].R * gain;
 		}
+
+		settled = silent && quiet >= delaybufsize && detectoravg == lastdetectoravg &&
+			compgain == lastcompgain && maxcompdiffdb == lastmaxcompdiffdb &&
+			metergain == lastmetergain;
 	}
 
+	sf_denormal_leave(&dn);
+
 	state->metergain     = metergain;
 	state->detectoravg   = detectoravg;
 	state->compgain      = compgain;
 	state->maxcompdiffdb = maxcompdiffdb;
 	state->delaywritepos = delaywritepos;
 	state->delayreadpos  = delayreadpos;
+	state->quiet         = quiet;
+	state->settled       = settled;
+}
+
+void sf_compressor_process(sf_compressor_state_st *state, int64_t size, sf_sample_st *input,
+	sf_sample_st *output){
+	compressor_process(state, size, &input->L, &input->R, &output->L, &output->R, 2);
+}
+
+void sf_compressor_process_planar(sf_compressor_state_st *state, int64_t size, const float *inputL,
+	const float *inputR, float *outputL, float *outputR){
+	compressor_process(state, size, inputL, inputR, outputL, outputR, 1);
 }
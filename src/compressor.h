@@ -12,6 +12,7 @@
 #define SNDFILTER_COMPRESSOR__H
 
 #include "snd.h"
+#include <stddef.h>
 
 // dynamic range compression is a complex topic with many different algorithms
 //
@@ -29,11 +30,18 @@
 // notice that sf_compressor_process will change a lot of the member variables inside of the state
 // structure, since these values must be carried over across chunk boundaries
 //
+// the output can be the same buffer as the input, to compress the sound in place; the samples
+// after the last full SPU subchunk of a chunk aren't written, so in place they still hold the input
+//
+// once the predelay only holds silence and the envelope has stopped moving, subchunks of silence
+// are written straight out, which gives exactly the same result as running them through
+//
 // also notice that the choice to divide the sound into chunks of 128 samples is completely
 // arbitrary from the compressor's perspective, however, the size should be divisible by the SPU
 // value below (defaults to 32):
 
-// maximum number of samples in the delay buffer
+// maximum number of samples in the delay buffer of a full structure (sf_compressor_newadvance
+// allocates the exact size instead, for predelays up to 1 second)
 #define SF_COMPRESSOR_MAXDELAY   1024
 
 // samples per update; the compressor works by dividing the input chunks into even smaller sizes,
@@ -72,10 +80,15 @@ typedef struct {
 	float detectoravg;
 	float compgain;
 	float maxcompdiffdb;
-	int delaybufsize;
+	int delaybufsize; // size of the predelay ring (which can be larger than the predelay)
+	int delaymask;    // delaybufsize - 1 if it's a power of 2 and positions wrap with a mask, or 0
 	int delaywritepos;
 	int delayreadpos;
-	sf_sample_st delaybuf[SF_COMPRESSOR_MAXDELAY]; // predelay buffer
+	int quiet;    // silent input samples in a row, up to delaybufsize
+	bool settled; // the predelay ring is silent, and more silence doesn't change anything
+	bool full;    // the whole structure is there (not from sf_compressor_newadvance)
+	// predelay ring (must be last, since sf_compressor_newadvance only allocates the part it needs)
+	sf_sample_st delaybuf[SF_COMPRESSOR_MAXDELAY];
 } sf_compressor_state_st;
 
 // populate a compressor state with all default values
@@ -106,9 +119,35 @@ void sf_advancecomp(sf_compressor_state_st *state,
 	float wet           // amount to apply the effect [0 completely dry to 1 completely wet]
 );
 
+// allocate a compressor state with a predelay ring of exactly the predelay's length (up to 1
+// second), instead of a full structure, and populate it with advanced parameters (returns NULL
+// for error)
+// if `pow2` is true, the ring is rounded up to a power of 2 so positions wrap with a mask instead
+// of a division; the predelay itself stays the same
+// the state can't be passed to the functions above afterwards; create a new one instead
+// the allocation ends partway through delaybuf, so the state can't be copied with = or memcpy
+// (which would read past the end of a short ring, or drop the end of a long one); a full structure
+// from the functions above can be
+sf_compressor_state_st *sf_compressor_newadvance(int rate, float pregain, float threshold,
+	float knee, float ratio, float attack, float release, float predelay, float releasezone1,
+	float releasezone2, float releasezone3, float releasezone4, float postgain, float wet,
+	bool pow2);
+
+// free a state from sf_compressor_newadvance
+void sf_compressor_free(sf_compressor_state_st *state);
+
+// bytes of memory used by a populated state (the size of the allocation, for
+// sf_compressor_newadvance, or sizeof(sf_compressor_state_st) for a full structure)
+size_t sf_compressor_memsize(sf_compressor_state_st *state);
+
 // this function will process the input sound based on the state passed
-// the input and output buffers should be the same size
-void sf_compressor_process(sf_compressor_state_st *state, int size, sf_sample_st *input,
+// the input and output buffers should be the same size, and can be the same buffer (but shouldn't
+// otherwise overlap)
+void sf_compressor_process(sf_compressor_state_st *state, int64_t size, sf_sample_st *input,
 	sf_sample_st *output);
 
+// same as above, but with each channel in its own buffer (see sf_psnd in snd.h)
+void sf_compressor_process_planar(sf_compressor_state_st *state, int64_t size, const float *inputL,
+	const float *inputR, float *outputL, float *outputR);
+
 #endif // SNDFILTER_COMPRESSOR__H
@@ -0,0 +1,479 @@
+//
+// sndfilter - Algorithms for sound filters, like reverb, lowpass, etc
+// by Sean Connelly (@velipso), https://sean.fun
+// Project Home: https://github.com/velipso/sndfilter
+// SPDX-License-Identifier: 0BSD
+//
+
+#include "convert.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	include <immintrin.h>
+#	define CONVERT_AVX2
+#	if defined(__SSE2__)
+#		define CONVERT_SSE2
+#	endif
+#endif
+
+//
+// scalar versions
+//
+// these are the reference formulas, and also handle the leftover samples after the vector loops
+//
+
+// notice that int16 samples range from -32768 to 32767, therefore we have a different divisor
+// depending on whether the value is negative or not
+static inline float s16tof(const uint8_t *p){
+	int16_t v = (int16_t)(p[0] | (p[1] << 8));
+	if (v < 0)
+		return (float)v / 32768.0f;
+	return (float)v / 32767.0f;
+}
+
+static inline float clampf(float v, float min, float max){
+	return v < min ? min : (v > max ? max : v);
+}
+
+static inline void puts16(uint8_t *p, int16_t v){
+	p[0] = (uint16_t)v & 0xFF;
+	p[1] = ((uint16_t)v >> 8) & 0xFF;
+}
+
+// once again, int16 samples range from -32768 to 32767, so we need to scale the floating point
+// sample by a different factor depending on whether it's negative
+static inline int16_t ftos16(float v){
+	v = clampf(v, -1, 1);
+	if (v < 0)
+		return (int16_t)(v * 32768.0f);
+	return (int16_t)(v * 32767.0f);
+}
+
+// xorshift32 generator
+static inline uint32_t xorshift(uint32_t x){
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+// turn 23 random bits into a float [0, 1)
+static inline float randf(uint32_t x){
+	union { uint32_t i; float f; } u = { .i = 0x3F800000 | (x >> 9) };
+	return u.f - 1.0f;
+}
+
+static inline int16_t ftos16_dither(float v, uint32_t *lane){
+	uint32_t r1 = xorshift(*lane);
+	uint32_t r2 = xorshift(r1);
+	*lane = r2;
+	v = clampf(v, -1, 1);
+	v = v * (v < 0 ? 32768.0f : 32767.0f) + (randf(r1) - randf(r2)); // triangular, +/-1 LSB
+	long r = lrintf(v);
+	return (int16_t)(r < -32768 ? -32768 : (r > 32767 ? 32767 : r));
+}
+
+void sf_dither_init(sf_dither_st *dither, uint32_t seed){
+	// spread the seed across the lanes, making sure no lane is zero (xorshift would get stuck)
+	uint32_t x = seed ^ 0x9E3779B9;
+	for (int i = 0; i < 8; i++){
+		x = x * 1664525 + 1013904223;
+		dither->lanes[i] = x ? x : 1;
+	}
+}
+
+//
+// vector versions
+//
+
+#if defined(CONVERT_AVX2)
+
+// compiled for AVX2 even when the rest of the file isn't, since the CPU is checked before it's used
+
+// 16 int16 values per step
+__attribute__((target("avx2")))
+static inline void s16tof_avx2(float *output, const uint8_t *input){
+	const __m256 negdiv = _mm256_set1_ps(32768.0f);
+	const __m256 posdiv = _mm256_set1_ps(32767.0f);
+	for (int h = 0; h < 2; h++){
+		__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(input + h * 16)));
+		__m256 f = _mm256_cvtepi32_ps(v);
+		__m256 div = _mm256_blendv_ps(posdiv, negdiv, _mm256_cmp_ps(f, _mm256_setzero_ps(),
+			_CMP_LT_OQ));
+		_mm256_storeu_ps(output + h * 8, _mm256_div_ps(f, div));
+	}
+}
+
+// 16 mono int16 values per step, expanded to 32 floats
+__attribute__((target("avx2")))
+static inline void s16tof_mono_avx2(float *output, const uint8_t *input){
+	float tmp[16];
+	s16tof_avx2(tmp, input);
+	for (int h = 0; h < 2; h++){
+		__m256 f = _mm256_loadu_ps(tmp + h * 8);
+		// interleave each value with itself, then fix the 128-bit lane order
+		__m256 lo = _mm256_unpacklo_ps(f, f);
+		__m256 hi = _mm256_unpackhi_ps(f, f);
+		_mm256_storeu_ps(output + h * 16    , _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(output + h * 16 + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+}
+
+__attribute__((target("avx2")))
+static inline __m256 scale_avx2(__m256 f){
+	f = _mm256_min_ps(_mm256_max_ps(f, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+	__m256 mul = _mm256_blendv_ps(_mm256_set1_ps(32767.0f), _mm256_set1_ps(32768.0f),
+		_mm256_cmp_ps(f, _mm256_setzero_ps(), _CMP_LT_OQ));
+	return _mm256_mul_ps(f, mul);
+}
+
+__attribute__((target("avx2")))
+static inline void ftos16_avx2(uint8_t *output, const float *input){
+	__m256i a = _mm256_cvttps_epi32(scale_avx2(_mm256_loadu_ps(input)));
+	__m256i b = _mm256_cvttps_epi32(scale_avx2(_mm256_loadu_ps(input + 8)));
+	// packs works within 128-bit lanes, so restore the order afterwards
+	__m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+	_mm256_storeu_si256((__m256i *)output, p);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i xorshift_avx2(__m256i x){
+	x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+	x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+	return x;
+}
+
+__attribute__((target("avx2")))
+static inline __m256 randf_avx2(__m256i x){
+	__m256i bits = _mm256_or_si256(_mm256_srli_epi32(x, 9), _mm256_set1_epi32(0x3F800000));
+	return _mm256_sub_ps(_mm256_castsi256_ps(bits), _mm256_set1_ps(1.0f));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i dither_avx2(__m256 f, __m256i *lanes){
+	__m256i r1 = xorshift_avx2(*lanes);
+	__m256i r2 = xorshift_avx2(r1);
+	*lanes = r2;
+	f = _mm256_add_ps(scale_avx2(f), _mm256_sub_ps(randf_avx2(r1), randf_avx2(r2)));
+	return _mm256_cvtps_epi32(f); // round to nearest; packs saturates afterwards
+}
+
+__attribute__((target("avx2")))
+static inline void ftos16_dither_avx2(uint8_t *output, const float *input, sf_dither_st *dither){
+	__m256i lanes = _mm256_loadu_si256((const __m256i *)dither->lanes);
+	__m256i a = dither_avx2(_mm256_loadu_ps(input), &lanes);
+	__m256i b = dither_avx2(_mm256_loadu_ps(input + 8), &lanes);
+	__m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+	_mm256_storeu_si256((__m256i *)output, p);
+	_mm256_storeu_si256((__m256i *)dither->lanes, lanes);
+}
+
+
+// the loops return how many values they converted, leaving the rest to the scalar versions
+__attribute__((target("avx2")))
+static int s16tof_loop_avx2(float *output, const uint8_t *input, int count){
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+		s16tof_avx2(output + i, input + i * 2);
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int s16tof_mono_loop_avx2(float *output, const uint8_t *input, int count){
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+		s16tof_mono_avx2(output + i * 2, input + i * 2);
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int ftos16_loop_avx2(uint8_t *output, const float *input, int count){
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+		ftos16_avx2(output + i * 2, input + i);
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int ftos16_dither_loop_avx2(uint8_t *output, const float *input, int count,
+	sf_dither_st *dither){
+	int i = 0;
+	for (; i + 16 <= count; i += 16)
+		ftos16_dither_avx2(output + i * 2, input + i, dither);
+	return i;
+}
+
+#endif
+
+#if defined(CONVERT_SSE2)
+
+// 8 int16 values per step
+static inline void s16tof_sse2(float *output, const uint8_t *input){
+	const __m128 negdiv = _mm_set1_ps(32768.0f);
+	const __m128 posdiv = _mm_set1_ps(32767.0f);
+	__m128i v = _mm_loadu_si128((const __m128i *)input);
+	// sign extend by placing each int16 in the top half of an int32, then shifting down
+	__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+	__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+	__m128 flo = _mm_cvtepi32_ps(lo);
+	__m128 fhi = _mm_cvtepi32_ps(hi);
+	__m128 mlo = _mm_cmplt_ps(flo, _mm_setzero_ps());
+	__m128 mhi = _mm_cmplt_ps(fhi, _mm_setzero_ps());
+	__m128 dlo = _mm_or_ps(_mm_and_ps(mlo, negdiv), _mm_andnot_ps(mlo, posdiv));
+	__m128 dhi = _mm_or_ps(_mm_and_ps(mhi, negdiv), _mm_andnot_ps(mhi, posdiv));
+	_mm_storeu_ps(output    , _mm_div_ps(flo, dlo));
+	_mm_storeu_ps(output + 4, _mm_div_ps(fhi, dhi));
+}
+
+// 8 mono int16 values per step, expanded to 16 floats
+static inline void s16tof_mono_sse2(float *output, const uint8_t *input){
+	float tmp[8];
+	s16tof_sse2(tmp, input);
+	for (int h = 0; h < 2; h++){
+		__m128 f = _mm_loadu_ps(tmp + h * 4);
+		_mm_storeu_ps(output + h * 8    , _mm_unpacklo_ps(f, f));
+		_mm_storeu_ps(output + h * 8 + 4, _mm_unpackhi_ps(f, f));
+	}
+}
+
+static inline __m128 scale_sse2(__m128 f){
+	f = _mm_min_ps(_mm_max_ps(f, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+	__m128 m = _mm_cmplt_ps(f, _mm_setzero_ps());
+	__m128 mul = _mm_or_ps(_mm_and_ps(m, _mm_set1_ps(32768.0f)),
+		_mm_andnot_ps(m, _mm_set1_ps(32767.0f)));
+	return _mm_mul_ps(f, mul);
+}
+
+static inline void ftos16_sse2(uint8_t *output, const float *input){
+	__m128i a = _mm_cvttps_epi32(scale_sse2(_mm_loadu_ps(input)));
+	__m128i b = _mm_cvttps_epi32(scale_sse2(_mm_loadu_ps(input + 4)));
+	_mm_storeu_si128((__m128i *)output, _mm_packs_epi32(a, b));
+}
+
+static inline __m128i xorshift_sse2(__m128i x){
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+	return x;
+}
+
+static inline __m128 randf_sse2(__m128i x){
+	__m128i bits = _mm_or_si128(_mm_srli_epi32(x, 9), _mm_set1_epi32(0x3F800000));
+	return _mm_sub_ps(_mm_castsi128_ps(bits), _mm_set1_ps(1.0f));
+}
+
+static inline __m128i dither_sse2(__m128 f, __m128i *lanes){
+	__m128i r1 = xorshift_sse2(*lanes);
+	__m128i r2 = xorshift_sse2(r1);
+	*lanes = r2;
+	f = _mm_add_ps(scale_sse2(f), _mm_sub_ps(randf_sse2(r1), randf_sse2(r2)));
+	return _mm_cvtps_epi32(f); // round to nearest; packs saturates afterwards
+}
+
+static inline void ftos16_dither_sse2(uint8_t *output, const float *input, sf_dither_st *dither){
+	__m128i lanes1 = _mm_loadu_si128((const __m128i *)dither->lanes);
+	__m128i lanes2 = _mm_loadu_si128((const __m128i *)(dither->lanes + 4));
+	__m128i a = dither_sse2(_mm_loadu_ps(input), &lanes1);
+	__m128i b = dither_sse2(_mm_loadu_ps(input + 4), &lanes2);
+	_mm_storeu_si128((__m128i *)output, _mm_packs_epi32(a, b));
+	_mm_storeu_si128((__m128i *)dither->lanes, lanes1);
+	_mm_storeu_si128((__m128i *)(dither->lanes + 4), lanes2);
+}
+
+
+// the loops return how many values they converted, leaving the rest to the scalar versions
+static int s16tof_loop_sse2(float *output, const uint8_t *input, int count){
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+		s16tof_sse2(output + i, input + i * 2);
+	return i;
+}
+
+static int s16tof_mono_loop_sse2(float *output, const uint8_t *input, int count){
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+		s16tof_mono_sse2(output + i * 2, input + i * 2);
+	return i;
+}
+
+static int ftos16_loop_sse2(uint8_t *output, const float *input, int count){
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+		ftos16_sse2(output + i * 2, input + i);
+	return i;
+}
+
+static int ftos16_dither_loop_sse2(uint8_t *output, const float *input, int count,
+	sf_dither_st *dither){
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+		ftos16_dither_sse2(output + i * 2, input + i, dither);
+	return i;
+}
+
+#endif
+
+// the vector loops picked for this machine
+typedef struct {
+	int (*s16tof)(float *output, const uint8_t *input, int count);
+	int (*s16tof_mono)(float *output, const uint8_t *input, int count);
+	int (*ftos16)(uint8_t *output, const float *input, int count);
+	int (*ftos16_dither)(uint8_t *output, const float *input, int count, sf_dither_st *dither);
+} loops_st;
+
+static int s16tof_none(float *, const uint8_t *, int){
+	return 0;
+}
+
+static int ftos16_none(uint8_t *, const float *, int){
+	return 0;
+}
+
+static int ftos16_dither_none(uint8_t *, const float *, int, sf_dither_st *){
+	return 0;
+}
+
+static const loops_st loops_none = { s16tof_none, s16tof_none, ftos16_none, ftos16_dither_none };
+#if defined(CONVERT_AVX2)
+static const loops_st loops_avx2 = { s16tof_loop_avx2, s16tof_mono_loop_avx2, ftos16_loop_avx2,
+	ftos16_dither_loop_avx2 };
+#endif
+#if defined(CONVERT_SSE2)
+static const loops_st loops_sse2 = { s16tof_loop_sse2, s16tof_mono_loop_sse2, ftos16_loop_sse2,
+	ftos16_dither_loop_sse2 };
+#endif
+
+// set on first use
+static const loops_st *loops = NULL;
+
+static const loops_st *pick_loops(){
+#if defined(CONVERT_AVX2)
+	if (__builtin_cpu_supports("avx2"))
+		return &loops_avx2;
+#endif
+#if defined(CONVERT_SSE2)
+	return &loops_sse2;
+#else
+	return &loops_none;
+#endif
+}
+
+static inline const loops_st *get_loops(){
+	// threads racing through here all pick the same loops, so it doesn't matter who stores them
+	const loops_st *l = __atomic_load_n(&loops, __ATOMIC_RELAXED);
+	if (l == NULL){
+		l = pick_loops();
+		__atomic_store_n(&loops, l, __ATOMIC_RELAXED);
+	}
+	return l;
+}
+
+//
+// public API
+//
+
+void sf_s16tof(float *output, const uint8_t *input, int count){
+	for (int i = get_loops()->s16tof(output, input, count); i < count; i++)
+		output[i] = s16tof(input + i * 2);
+}
+
+void sf_s16tof_mono(float *output, const uint8_t *input, int count){
+	for (int i = get_loops()->s16tof_mono(output, input, count); i < count; i++)
+		output[i * 2] = output[i * 2 + 1] = s16tof(input + i * 2);
+}
+
+void sf_ftos16(uint8_t *output, const float *input, int count, sf_dither_st *dither){
+	if (dither){
+		for (int i = get_loops()->ftos16_dither(output, input, count, dither); i < count; i++)
+			puts16(output + i * 2, ftos16_dither(input[i], &dither->lanes[i & 7]));
+		return;
+	}
+	for (int i = get_loops()->ftos16(output, input, count); i < count; i++)
+		puts16(output + i * 2, ftos16(input[i]));
+}
+
+//
+// int24 and float32
+//
+
+static inline float s24tof(const uint8_t *p){
+	// place the value in the top 24 bits, then shift down to sign extend
+	uint32_t u = ((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24);
+	int32_t v = (int32_t)u >> 8;
+	if (v < 0)
+		return (float)v / 8388608.0f;
+	return (float)v / 8388607.0f;
+}
+
+static inline int32_t ftos24(float v){
+	v = clampf(v, -1, 1);
+	if (v < 0)
+		return (int32_t)(v * 8388608.0f);
+	return (int32_t)(v * 8388607.0f);
+}
+
+void sf_s24tof(float *output, const uint8_t *input, int count){
+	for (int i = 0; i < count; i++)
+		output[i] = s24tof(input + i * 3);
+}
+
+void sf_s24tof_mono(float *output, const uint8_t *input, int count){
+	for (int i = 0; i < count; i++)
+		output[i * 2] = output[i * 2 + 1] = s24tof(input + i * 3);
+}
+
+void sf_ftos24(uint8_t *output, const float *input, int count){
+	for (int i = 0; i < count; i++){
+		uint32_t v = (uint32_t)ftos24(input[i]);
+		output[i * 3    ] = v & 0xFF;
+		output[i * 3 + 1] = (v >> 8) & 0xFF;
+		output[i * 3 + 2] = (v >> 16) & 0xFF;
+	}
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static inline float f32tof(const uint8_t *p){
+	union { uint32_t i; float f; } u = {
+		.i = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+			((uint32_t)p[3] << 24)
+	};
+	return u.f;
+}
+
+void sf_f32tof(float *output, const uint8_t *input, int count){
+	for (int i = 0; i < count; i++)
+		output[i] = f32tof(input + i * 4);
+}
+
+void sf_ftof32(uint8_t *output, const float *input, int count){
+	for (int i = 0; i < count; i++){
+		union { float f; uint32_t i; } u = { .f = input[i] };
+		output[i * 4    ] = u.i & 0xFF;
+		output[i * 4 + 1] = (u.i >> 8) & 0xFF;
+		output[i * 4 + 2] = (u.i >> 16) & 0xFF;
+		output[i * 4 + 3] = (u.i >> 24) & 0xFF;
+	}
+}
+#else
+// little endian float32 is already in the right layout
+static inline float f32tof(const uint8_t *p){
+	float v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+void sf_f32tof(float *output, const uint8_t *input, int count){
+	memcpy(output, input, sizeof(float) * count);
+}
+
+void sf_ftof32(uint8_t *output, const float *input, int count){
+	memcpy(output, input, sizeof(float) * count);
+}
+#endif
+
+void sf_f32tof_mono(float *output, const uint8_t *input, int count){
+	for (int i = 0; i < count; i++)
+		output[i * 2] = output[i * 2 + 1] = f32tof(input + i * 4);
+}
@@ -0,0 +1,55 @@
+//
+// sndfilter - Algorithms for sound filters, like reverb, lowpass, etc
+// by Sean Connelly (@velipso), https://sean.fun
+// Project Home: https://github.com/velipso/sndfilter
+// SPDX-License-Identifier: 0BSD
+//
+
+// sample format conversion between little endian int16/int24/float32 data and floating point
+
+#ifndef SNDFILTER_CONVERT__H
+#define SNDFILTER_CONVERT__H
+
+#include <stdint.h>
+
+// on x86 these kernels use AVX2 when the CPU has it (checked once, at the first call), or SSE2 when
+// the compiler targets it, and fall back to plain C everywhere else; every implementation produces
+// exactly the same results as the scalar formulas:
+//
+//   int16 -> float    v < 0 ? v / 32768 : v / 32767
+//   float -> int16    clamp to [-1, 1], then v < 0 ? v * 32768 : v * 32767, truncated
+//
+// the int24 conversions use the same formulas scaled to 24 bits, in plain C; float32 data is
+// copied as is (not clamped), which is just a memcpy on little endian machines
+
+// TPDF dither state for float -> int16 conversion
+// dither adds triangular noise of +/-1 LSB before rounding to the nearest integer, which turns the
+// quantization error into benign white noise instead of distortion correlated with the signal
+typedef struct {
+	uint32_t lanes[8]; // independent xorshift generators, one per vector lane
+} sf_dither_st;
+
+// seed the dither generators
+void sf_dither_init(sf_dither_st *dither, uint32_t seed);
+
+// convert `count` int16 values stored as little endian bytes in `input` to floating point
+void sf_s16tof(float *output, const uint8_t *input, int count);
+
+// convert `count` mono int16 values to stereo by writing each one twice (output needs 2 * count)
+void sf_s16tof_mono(float *output, const uint8_t *input, int count);
+
+// convert `count` floating point values to int16 stored as little endian bytes in `output`
+// if `dither` is not NULL, TPDF dither is applied and the state is advanced
+void sf_ftos16(uint8_t *output, const float *input, int count, sf_dither_st *dither);
+
+// int24 versions of the above, with 3 bytes per value (no dither)
+void sf_s24tof(float *output, const uint8_t *input, int count);
+void sf_s24tof_mono(float *output, const uint8_t *input, int count);
+void sf_ftos24(uint8_t *output, const float *input, int count);
+
+// float32 versions of the above
+void sf_f32tof(float *output, const uint8_t *input, int count);
+void sf_f32tof_mono(float *output, const uint8_t *input, int count);
+void sf_ftof32(uint8_t *output, const float *input, int count);
+
+#endif // SNDFILTER_CONVERT__H
@@ -0,0 +1,100 @@
+//
+// sndfilter - Algorithms for sound filters, like reverb, lowpass, etc
+// by Sean Connelly (@velipso), https://sean.fun
+// Project Home: https://github.com/velipso/sndfilter
+// SPDX-License-Identifier: 0BSD
+//
+
+// denormal protection, shared by the filters
+
+#ifndef SNDFILTER_DENORMAL__H
+#define SNDFILTER_DENORMAL__H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// as a recursive filter rings out after the sound goes quiet, its state shrinks until it falls
+// below the smallest normal float; most CPUs handle those tiny (denormal) numbers in microcode,
+// which can be 10-100x slower per operation, so the CPU use spikes exactly when the sound is silent
+//
+// the process functions avoid this by switching the FPU to flush denormals to zero while they run
+// (FTZ and DAZ on x86, FZ on ARM), and putting the caller's mode back when they return
+//
+// where the FPU can't do that (like on the ESP32), or with SF_DENORMAL_FTZ set to 0, the recursive
+// parts of the filters pass their state through sf_denormal_flush instead
+#ifndef SF_DENORMAL_FTZ
+#	define SF_DENORMAL_FTZ  1
+#endif
+
+#if SF_DENORMAL_FTZ && defined(__SSE__)
+#	include <xmmintrin.h>
+#	define SF_DENORMAL_X86
+#elif SF_DENORMAL_FTZ && defined(__aarch64__)
+#	define SF_DENORMAL_A64
+#elif SF_DENORMAL_FTZ && defined(__arm__) && defined(__ARM_FP)
+#	define SF_DENORMAL_A32
+#endif
+
+// sf_denormal_flush adds and removes this offset, which rounds anything far below it to exactly
+// zero; anything above about 3e-11 (where half a float step is bigger than the offset) comes back
+// unchanged, and anything smaller only moves by about the size of the offset
+#ifndef SF_DENORMAL_OFFSET
+#	define SF_DENORMAL_OFFSET  1e-18f
+#endif
+
+typedef struct {
+	uint64_t mode; // the caller's mode
+	bool changed;  // whether the mode needs to be put back
+} sf_denormal_st;
+
+static inline void sf_denormal_enter(sf_denormal_st *dn){
+#if defined(SF_DENORMAL_X86)
+	uint32_t mode = _mm_getcsr();
+	uint32_t flush = mode | 0x8040; // FTZ | DAZ
+#elif defined(SF_DENORMAL_A64)
+	uint64_t mode;
+	__asm__ __volatile__ ("mrs %0, fpcr" : "=r"(mode));
+	uint64_t flush = mode | (1 << 24); // FZ
+#elif defined(SF_DENORMAL_A32)
+	uint32_t mode;
+	__asm__ __volatile__ ("vmrs %0, fpscr" : "=r"(mode));
+	uint32_t flush = mode | (1 << 24); // FZ
+#else
+	uint64_t mode = 0, flush = 0;
+#endif
+	dn->mode = mode;
+	dn->changed = flush != mode;
+	if (!dn->changed)
+		return;
+#if defined(SF_DENORMAL_X86)
+	_mm_setcsr(flush);
+#elif defined(SF_DENORMAL_A64)
+	__asm__ __volatile__ ("msr fpcr, %0" : : "r"(flush));
+#elif defined(SF_DENORMAL_A32)
+	__asm__ __volatile__ ("vmsr fpscr, %0" : : "r"(flush));
+#endif
+}
+
+static inline void sf_denormal_leave(const sf_denormal_st *dn){
+	if (!dn->changed)
+		return;
+#if defined(SF_DENORMAL_X86)
+	_mm_setcsr((uint32_t)dn->mode);
+#elif defined(SF_DENORMAL_A64)
+	__asm__ __volatile__ ("msr fpcr, %0" : : "r"(dn->mode));
+#elif defined(SF_DENORMAL_A32)
+	__asm__ __volatile__ ("vmsr fpscr, %0" : : "r"((uint32_t)dn->mode));
+#endif
+}
+
+// flush a value that's close to becoming a denormal to zero, when the FPU isn't doing it already
+static inline float sf_denormal_flush(float v){
+#if defined(SF_DENORMAL_X86) || defined(SF_DENORMAL_A64) || defined(SF_DENORMAL_A32)
+	return v;
+#else
+	v += SF_DENORMAL_OFFSET;
+	return v - SF_DENORMAL_OFFSET;
+#endif
+}
+
+#endif // SNDFILTER_DENORMAL__H
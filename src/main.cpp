@@ -11,10 +11,25 @@
 #include "biquad.h"
 #include "compressor.h"
 #include "reverb.h"
+#include "mem.h"
+#include "pipeline.h"
+#include "offline.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// output files are saved in the same sample format as the input file
+static sf_wav_format outformat = SF_WAV_PCM16;
+
+// in pipelined mode, streaming runs the reading, filtering, and writing on separate threads
+static bool pipelined = false;
+
+// in zero-phase mode, the biquad filters run forwards and backwards over the whole sound
+static bool zerophase = false;
+
+// number of threads that split the sound in zero-phase mode
+#define ZEROPHASE_THREADS  4
+
 static int printabout(){
 	printf(
 		"sndfilter - simple demonstrations of common sound filters\n"
@@ -29,11 +44,16 @@ static int printhelp(){
 	printabout();
 	printf("\n"
 		"Usage:\n"
-		"  sndfilter input.wav output.wav <filter> <...>\n"
+		"  sndfilter [--stream | --pipeline | --zerophase] input.wav output.wav <filter> <...>\n"
 		"\n"
 		"Where:\n"
+		"  --stream     Process the file in small chunks instead of loading it all into memory\n"
+		"  --pipeline   Same as --stream, but read and write on separate threads while filtering\n"
+		"  --zerophase  Run the filter forwards and then backwards, which cancels out the phase\n"
+		"               shift and doubles the effect (only for the biquad filters)\n"
 		"  input.wav    Input WAV file to process\n"
-		"  output.wav   Output WAV file of filtered results\n"
+		"  output.wav   Output WAV file of filtered results, saved in the same sample format as\n"
+		"               the input (16-bit, 24-bit, or 32-bit float)\n"
 		"  <filter>     One of the available filters (see below)\n"
 		"  <...>        Additional parameters for the particular filter\n"
 		"\n"
@@ -116,20 +136,26 @@ static inline int badargs(const char *filter){
 	return 1;
 }
 
-static inline int biquad(sf_snd input_snd, sf_biquad_state_st *state, const char *output){
-	sf_snd output_snd = sf_snd_new(input_snd->size, input_snd->rate, false);
-	if (output_snd == NULL){
+// closes whichever input was opened (the reader or the whole sound), for giving up before filtering
+static inline int closeinput(sf_wavreader_st *rd, sf_snd input_snd, int res){
+	if (rd)
+		sf_wavreader_close(rd);
+	if (input_snd)
 		sf_snd_free(input_snd);
-		fprintf(stderr, "Error: Failed to apply filter\n");
-		return 1;
-	}
+	return res;
+}
 
-	// process the filter in one sweep
-	sf_biquad_process(state, input_snd->size, input_snd->samples, output_snd->samples);
+// the filters can process a sound in place, so the demo never needs a second copy of the sound
+
+static inline int biquad(sf_snd input_snd, sf_biquad_state_st *state, const char *output){
+	// process the filter in one sweep (or two, for zero-phase)
+	if (zerophase)
+		sf_biquad_filtfilt(state, input_snd->size, input_snd->samples, ZEROPHASE_THREADS);
+	else
+		sf_biquad_process(state, input_snd->size, input_snd->samples, input_snd->samples);
 
-	bool res = sf_wavsave(output_snd, output);
+	bool res = sf_wavsavefmt(input_snd, output, outformat);
 	sf_snd_free(input_snd);
-	sf_snd_free(output_snd);
 	if (!res){
 		fprintf(stderr, "Error: Failed to save WAV: %s\n", output);
 		return 1;
@@ -138,24 +164,20 @@ static inline int biquad(sf_snd input_snd, sf_biquad_state_st *state, const char
 }
 
 static inline int compressor(sf_snd input_snd, sf_compressor_state_st *state, const char *output){
-	sf_snd output_snd = sf_snd_new(input_snd->size, input_snd->rate, true);
-	if (output_snd == NULL){
-		sf_snd_free(input_snd);
-		fprintf(stderr, "Error: Failed to apply filter\n");
-		return 1;
-	}
-
 	// process the compressor in one sweep
-	sf_compressor_process(state, input_snd->size, input_snd->samples, output_snd->samples);
+	sf_compressor_process(state, input_snd->size, input_snd->samples, input_snd->samples);
 
 	// note that the compressor does not output one sample per input sample, because the compressor
 	// works in subchunks of 32 samples (this is defined via SF_COMPRESSOR_SPU in compressor.c)
 	//
-	// that means the output size will be floor(input_size / 32) * 32
+	// that means the output size will be floor(input_size / 32) * 32, and the samples after that
+	// still hold the input, so silence them
+	int64_t done = (input_snd->size / SF_COMPRESSOR_SPU) * SF_COMPRESSOR_SPU;
+	if (done < input_snd->size)
+		memset(&input_snd->samples[done], 0, sizeof(sf_sample_st) * (input_snd->size - done));
 
-	bool res = sf_wavsave(output_snd, output);
+	bool res = sf_wavsavefmt(input_snd, output, outformat);
 	sf_snd_free(input_snd);
-	sf_snd_free(output_snd);
 	if (!res){
 		fprintf(stderr, "Error: Failed to save WAV: %s\n", output);
 		return 1;
@@ -163,7 +185,7 @@ static inline int compressor(sf_snd input_snd, sf_compressor_state_st *state, co
 	return 0;
 }
 
-static inline int reverb(sf_snd input_snd, float tail, const char *preset, const char *output){
+static inline bool getpreset(const char *preset, sf_reverb_preset *out){
 	sf_reverb_preset p;
 	if      (strcmp(preset, "default"    ) == 0) p = SF_REVERB_PRESET_DEFAULT;
 	else if (strcmp(preset, "smallhall1" ) == 0) p = SF_REVERB_PRESET_SMALLHALL1;
@@ -186,43 +208,165 @@ static inline int reverb(sf_snd input_snd, float tail, const char *preset, const
 	else if (strcmp(preset, "longreverb2") == 0) p = SF_REVERB_PRESET_LONGREVERB2;
 	else{
 		fprintf(stderr, "Error: Invalid reverb preset: %s\n", preset);
-		return 1;
+		return false;
 	}
+	*out = p;
+	return true;
+}
 
-	int tailsmp = tail * input_snd->rate;
-	sf_snd output_snd = sf_snd_new(input_snd->size + tailsmp, input_snd->rate, true);
-	if (output_snd == NULL){
+// number of samples of the reverb tail generated at a time
+#define TAIL_CHUNK  4096
+
+static inline int reverb(sf_snd input_snd, float tail, sf_reverb_preset p, const char *output){
+	int64_t tailsmp = tail * input_snd->rate;
+	sf_reverb_state_st *rv = sf_reverb_new(input_snd->rate, p);
+	sf_sample_st *tail_buf = (sf_sample_st *)sf_aligned_malloc(
+		sf_alignsize(sizeof(sf_sample_st) * TAIL_CHUNK), SF_ALIGN);
+	if (rv == NULL || tail_buf == NULL){
+		if (rv)
+			sf_reverb_free(rv);
+		sf_aligned_free(tail_buf);
 		sf_snd_free(input_snd);
 		fprintf(stderr, "Error: Failed to apply filter\n");
 		return 1;
 	}
 
 	// process the reverb in one sweep
-	sf_reverb_state_st rv;
-	sf_presetreverb(&rv, input_snd->rate, p);
-	sf_reverb_process(&rv, input_snd->size, input_snd->samples, output_snd->samples);
+	sf_reverb_process(rv, input_snd->size, input_snd->samples, input_snd->samples);
 
-	// append the tail
-	if (tailsmp > 0){
-		int pos = input_snd->size;
-		sf_sample_st empty[48000];
-		memset(empty, 0, sizeof(sf_sample_st) * 48000);
-		while (tailsmp > 0){
-			if (tailsmp <= 48000){
-				sf_reverb_process(&rv, tailsmp, empty, &output_snd->samples[pos]);
-				break;
-			}
-			else{
-				sf_reverb_process(&rv, 48000, empty, &output_snd->samples[pos]);
-				tailsmp -= 48000;
-				pos += 48000;
-			}
+	// save the sound, then generate the tail a chunk at a time and append it to the file, instead
+	// of making room for the tail in the sound
+	sf_wavwriter_st *wr = sf_wavwriter_openfmt(output, input_snd->rate,
+		input_snd->size + tailsmp, outformat);
+	bool res = wr != NULL && sf_wavwriter_write(wr, input_snd->size, input_snd->samples);
+	sf_snd_free(input_snd);
+	while (res && tailsmp > 0){
+		int64_t n = tailsmp < TAIL_CHUNK ? tailsmp : TAIL_CHUNK;
+		memset(tail_buf, 0, sizeof(sf_sample_st) * n);
+		sf_reverb_process(rv, n, tail_buf, tail_buf);
+		res = sf_wavwriter_write(wr, n, tail_buf);
+		tailsmp -= n;
+	}
+	if (wr)
+		res = sf_wavwriter_close(wr) && res;
+	sf_reverb_free(rv);
+	sf_aligned_free(tail_buf);
+	if (!res){
+		fprintf(stderr, "Error: Failed to save WAV: %s\n", output);
+		return 1;
+	}
+	return 0;
+}
+
+//
+// streaming mode
+//
+
+// number of samples processed at a time in streaming mode; this must be a multiple of
+// SF_COMPRESSOR_SPU so the compressor processes every sample of a full chunk
+#define STREAM_CHUNK  4096
+
+// number of chunks queued on each side of the filter in pipelined mode
+#define PIPELINE_DEPTH  4
+
+typedef sf_pipeline_func process_func;
+
+static void process_biquad(void *state, int64_t size, sf_sample_st *input, sf_sample_st *output){
+	sf_biquad_process((sf_biquad_state_st *)state, size, input, output);
+}
+
+static void process_compressor(void *state, int64_t size, sf_sample_st *input,
+	sf_sample_st *output){
+	sf_compressor_process((sf_compressor_state_st *)state, size, input, output);
+	// the compressor skips the samples after the last full SF_COMPRESSOR_SPU subchunk, so silence
+	// them, which matches what the non-streaming mode outputs at the end of the file
+	int64_t done = (size / SF_COMPRESSOR_SPU) * SF_COMPRESSOR_SPU;
+	if (done < size)
+		memset(&output[done], 0, sizeof(sf_sample_st) * (size - done));
+}
+
+static void process_reverb(void *state, int64_t size, sf_sample_st *input, sf_sample_st *output){
+	sf_reverb_process((sf_reverb_state_st *)state, size, input, output);
+}
+
+// same as stream, but overlapping the reading, filtering, and writing
+static int pipeline(sf_wavreader_st *rd, process_func process, void *state, int64_t tailsmp,
+	const char *output){
+	sf_wavwriter_st *wr = sf_wavwriter_openfmt(output, sf_wavreader_rate(rd),
+		sf_wavreader_size(rd) + tailsmp, outformat);
+	if (wr == NULL){
+		sf_wavreader_close(rd);
+		fprintf(stderr, "Error: Failed to apply filter\n");
+		return 1;
+	}
+
+	sf_pipeline_result res = sf_pipeline(rd, wr, process, state, tailsmp, STREAM_CHUNK,
+		PIPELINE_DEPTH);
+	bool closed = sf_wavwriter_close(wr);
+	sf_wavreader_close(rd);
+	if (res == SF_PIPELINE_NOMEM){
+		fprintf(stderr, "Error: Failed to apply filter\n");
+		return 1;
+	}
+	if (res == SF_PIPELINE_READERR){
+		fprintf(stderr, "Error: Failed to read WAV\n");
+		return 1;
+	}
+	if (res == SF_PIPELINE_WRITEERR || !closed){
+		fprintf(stderr, "Error: Failed to save WAV: %s\n", output);
+		return 1;
+	}
+	return 0;
+}
+
+// stream the input through a filter in chunks of STREAM_CHUNK samples, followed by `tailsmp`
+// samples of silence
+static int stream(sf_wavreader_st *rd, process_func process, void *state, int64_t tailsmp,
+	const char *output){
+	if (pipelined)
+		return pipeline(rd, process, state, tailsmp, output);
+
+	// each chunk is processed in place
+	sf_sample_st *buf = (sf_sample_st *)sf_aligned_malloc(
+		sf_alignsize(sizeof(sf_sample_st) * STREAM_CHUNK), SF_ALIGN);
+	sf_wavwriter_st *wr = sf_wavwriter_openfmt(output, sf_wavreader_rate(rd),
+		sf_wavreader_size(rd) + tailsmp, outformat);
+	if (buf == NULL || wr == NULL){
+		sf_aligned_free(buf);
+		if (wr)
+			sf_wavwriter_close(wr);
+		sf_wavreader_close(rd);
+		fprintf(stderr, "Error: Failed to apply filter\n");
+		return 1;
+	}
+
+	bool res = true;
+	int64_t n;
+	while ((n = sf_wavreader_read(rd, STREAM_CHUNK, buf)) > 0){
+		process(state, n, buf, buf);
+		if (!sf_wavwriter_write(wr, n, buf)){
+			res = false;
+			break;
 		}
 	}
+	bool readerr = n < 0;
 
-	bool res = sf_wavsave(output_snd, output);
-	sf_snd_free(input_snd);
-	sf_snd_free(output_snd);
+	// append the tail
+	while (res && !readerr && tailsmp > 0){
+		n = tailsmp < STREAM_CHUNK ? tailsmp : STREAM_CHUNK;
+		memset(buf, 0, sizeof(sf_sample_st) * n);
+		process(state, n, buf, buf);
+		res = sf_wavwriter_write(wr, n, buf);
+		tailsmp -= n;
+	}
+
+	res = sf_wavwriter_close(wr) && res;
+	sf_wavreader_close(rd);
+	sf_aligned_free(buf);
+	if (readerr){
+		fprintf(stderr, "Error: Failed to read WAV\n");
+		return 1;
+	}
 	if (!res){
 		fprintf(stderr, "Error: Failed to save WAV: %s\n", output);
 		return 1;
@@ -231,6 +375,19 @@ static inline int reverb(sf_snd input_snd, float tail, const char *preset, const
 }
 
 int alt_main(int argc, char **argv){
+	// in streaming mode, the sound never gets loaded into memory as a whole
+	bool streaming = false;
+	if (argc > 1 && strcmp(argv[1], "--stream") == 0)
+		streaming = true;
+	else if (argc > 1 && strcmp(argv[1], "--pipeline") == 0)
+		streaming = pipelined = true;
+	else if (argc > 1 && strcmp(argv[1], "--zerophase") == 0)
+		zerophase = true;
+	if (streaming || zerophase){
+		argc--;
+		argv++;
+	}
+
 	if (argc < 4)
 		return printhelp();
 
@@ -238,77 +395,117 @@ int alt_main(int argc, char **argv){
 	const char *output = argv[2];
 	const char *filter = argv[3];
 
-	sf_snd input_snd = sf_wavload(input);
-	if (input_snd == NULL){
-		fprintf(stderr, "Error: Failed to load WAV: %s\n", input);
-		return 1;
+	sf_snd input_snd = NULL;
+	sf_wavreader_st *rd = NULL;
+	int rate;
+	if (streaming){
+		rd = sf_wavreader_open(input);
+		if (rd == NULL){
+			fprintf(stderr, "Error: Failed to load WAV: %s\n", input);
+			return 1;
+		}
+		rate = sf_wavreader_rate(rd);
+		outformat = sf_wavreader_format(rd);
+	}
+	else{
+		input_snd = sf_wavloadfmt(input, &outformat);
+		if (input_snd == NULL){
+			fprintf(stderr, "Error: Failed to load WAV: %s\n", input);
+			return 1;
+		}
+		rate = input_snd->rate;
 	}
 
 	float params[6];
 	sf_biquad_state_st bq_state;
 	if (strcmp(filter, "lowpass") == 0){
 		if (!getargs(argc, argv, 2, params))
-			return badargs(filter);
-		sf_lowpass(&bq_state, input_snd->rate, params[0], params[1]);
-		return biquad(input_snd, &bq_state, output);
+			return closeinput(rd, input_snd, badargs(filter));
+		sf_lowpass(&bq_state, rate, params[0], params[1]);
 	}
 	else if (strcmp(filter, "highpass") == 0){
 		if (!getargs(argc, argv, 2, params))
-			return badargs(filter);
-		sf_highpass(&bq_state, input_snd->rate, params[0], params[1]);
-		return biquad(input_snd, &bq_state, output);
+			return closeinput(rd, input_snd, badargs(filter));
+		sf_highpass(&bq_state, rate, params[0], params[1]);
 	}
 	else if (strcmp(filter, "bandpass") == 0){
 		if (!getargs(argc, argv, 2, params))
-			return badargs(filter);
-		sf_bandpass(&bq_state, input_snd->rate, params[0], params[1]);
-		return biquad(input_snd, &bq_state, output);
+			return closeinput(rd, input_snd, badargs(filter));
+		sf_bandpass(&bq_state, rate, params[0], params[1]);
 	}
 	else if (strcmp(filter, "notch") == 0){
 		if (!getargs(argc, argv, 2, params))
-			return badargs(filter);
-		sf_notch(&bq_state, input_snd->rate, params[0], params[1]);
-		return biquad(input_snd, &bq_state, output);
+			return closeinput(rd, input_snd, badargs(filter));
+		sf_notch(&bq_state, rate, params[0], params[1]);
 	}
 	else if (strcmp(filter, "peaking") == 0){
 		if (!getargs(argc, argv, 3, params))
-			return badargs(filter);
-		sf_peaking(&bq_state, input_snd->rate, params[0], params[1], params[2]);
-		return biquad(input_snd, &bq_state, output);
+			return closeinput(rd, input_snd, badargs(filter));
+		sf_peaking(&bq_state, rate, params[0], params[1], params[2]);
 	}
 	else if (strcmp(filter, "allpass") == 0){
 		if (!getargs(argc, argv, 2, params))
-			return badargs(filter);
-		sf_allpass(&bq_state, input_snd->rate, params[0], params[1]);
-		return biquad(input_snd, &bq_state, output);
+			return closeinput(rd, input_snd, badargs(filter));
+		sf_allpass(&bq_state, rate, params[0], params[1]);
 	}
 	else if (strcmp(filter, "lowshelf") == 0){
 		if (!getargs(argc, argv, 3, params))
-			return badargs(filter);
-		sf_lowshelf(&bq_state, input_snd->rate, params[0], params[1], params[2]);
-		return biquad(input_snd, &bq_state, output);
+			return closeinput(rd, input_snd, badargs(filter));
+		sf_lowshelf(&bq_state, rate, params[0], params[1], params[2]);
 	}
 	else if (strcmp(filter, "highshelf") == 0){
 		if (!getargs(argc, argv, 3, params))
-			return badargs(filter);
-		sf_highshelf(&bq_state, input_snd->rate, params[0], params[1], params[2]);
-		return biquad(input_snd, &bq_state, output);
+			return closeinput(rd, input_snd, badargs(filter));
+		sf_highshelf(&bq_state, rate, params[0], params[1], params[2]);
+	}
+	else if (zerophase){
+		fprintf(stderr, "Error: Zero-phase mode only works with the biquad filters\n");
+		return closeinput(rd, input_snd, 1);
 	}
 	else if (strcmp(filter, "compressor") == 0){
 		if (!getargs(argc, argv, 6, params))
-			return badargs(filter);
+			return closeinput(rd, input_snd, badargs(filter));
 		sf_compressor_state_st cm_state;
-		sf_simplecomp(&cm_state, input_snd->rate, params[0], params[1], params[2], params[3],
+		sf_simplecomp(&cm_state, rate, params[0], params[1], params[2], params[3],
 			params[4], params[5]);
+		if (streaming)
+			return stream(rd, process_compressor, &cm_state, 0, output);
 		return compressor(input_snd, &cm_state, output);
 	}
 	else if (strcmp(filter, "reverb") == 0){
 		if (argc < 6 || !getargs(argc, argv, 1, params))
-			return badargs(filter);
-		return reverb(input_snd, params[0], argv[5], output);
+			return closeinput(rd, input_snd, badargs(filter));
+		sf_reverb_preset p;
+		if (!getpreset(argv[5], &p))
+			return closeinput(rd, input_snd, 1);
+		if (streaming){
+			sf_reverb_state_st *rv = sf_reverb_new(rate, p);
+			if (rv == NULL){
+				sf_wavreader_close(rd);
+				fprintf(stderr, "Error: Failed to apply filter\n");
+				return 1;
+			}
+			int res = stream(rd, process_reverb, rv, params[0] * rate, output);
+			sf_reverb_free(rv);
+			return res;
+		}
+		return reverb(input_snd, params[0], p, output);
+	}
+	else{
+		printhelp();
+		fprintf(stderr, "Error: Bad filter \"%s\"\n", filter);
+		return closeinput(rd, input_snd, 1);
 	}
 
-	printhelp();
-	fprintf(stderr, "Error: Bad filter \"%s\"\n", filter);
-	return 1;
+	// all of the biquad filters end up here
+	if (streaming)
+		return stream(rd, process_biquad, &bq_state, 0, output);
+	return biquad(input_snd, &bq_state, output);
+}
+
+#if !defined(ARDUINO)
+// on a host, the demo is a regular command line program
+int main(int argc, char **argv){
+	return alt_main(argc, argv);
 }
+#endif
@@ -6,8 +6,31 @@
 //
 
 #include "mem.h"
+#include <stdint.h>
 #include <stdlib.h>
 
 // initialize sf_malloc/sf_free with the standard malloc/free
 sf_malloc_func sf_malloc = malloc;
 sf_free_func sf_free = free;
+
+// allocate enough extra to align the block, and store the original pointer just before it
+static void *aligned_malloc(size_t size, size_t align){
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+	if (size > SIZE_MAX - align - sizeof(void *))
+		return NULL;
+	void *mem = sf_malloc(size + align - 1 + sizeof(void *));
+	if (mem == NULL)
+		return NULL;
+	uintptr_t p = ((uintptr_t)mem + sizeof(void *) + align - 1) & ~(uintptr_t)(align - 1);
+	((void **)p)[-1] = mem;
+	return (void *)p;
+}
+
+static void aligned_free(void *ptr){
+	if (ptr)
+		sf_free(((void **)ptr)[-1]);
+}
+
+sf_aligned_malloc_func sf_aligned_malloc = aligned_malloc;
+sf_free_func sf_aligned_free = aligned_free;
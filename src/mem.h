@@ -11,6 +11,7 @@
 #define SNDFILTER_MEM__H
 
 #include <stddef.h>
+#include <stdint.h>
 
 typedef void *(*sf_malloc_func)(size_t size);
 typedef void (*sf_free_func)(void *ptr);
@@ -19,4 +20,28 @@ typedef void (*sf_free_func)(void *ptr);
 extern sf_malloc_func sf_malloc;
 extern sf_free_func sf_free;
 
+// aligned memory
+//
+// sample buffers and other large blocks are aligned to SF_ALIGN bytes (a cache line), and their
+// sizes are rounded up to a multiple of it, so vector loads never straddle cache lines and vector
+// loops can safely read the tail of a buffer in whole vectors
+#ifndef SF_ALIGN
+#define SF_ALIGN  64
+#endif
+
+// `align` is a power of two; memory from sf_aligned_malloc must be released with sf_aligned_free
+typedef void *(*sf_aligned_malloc_func)(size_t size, size_t align);
+
+// overwrite these globals to change the aligned malloc/free functions of the library
+// the defaults over-allocate through sf_malloc/sf_free, so overwriting those is enough by itself
+extern sf_aligned_malloc_func sf_aligned_malloc;
+extern sf_free_func sf_aligned_free;
+
+// round `size` up to a multiple of SF_ALIGN (returns 0 if that overflows)
+static inline size_t sf_alignsize(size_t size){
+	if (size > SIZE_MAX - (SF_ALIGN - 1))
+		return 0;
+	return (size + SF_ALIGN - 1) & ~(size_t)(SF_ALIGN - 1);
+}
+
 #endif // SNDFILTER_MEM__H
@@ -0,0 +1,415 @@
+//
+// sndfilter - Algorithms for sound filters, like reverb, lowpass, etc
+// by Sean Connelly (@velipso), https://sean.fun
+// Project Home: https://github.com/velipso/sndfilter
+// SPDX-License-Identifier: 0BSD
+//
+
+#include "offline.h"
+#include "mem.h"
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct {
+	int64_t start;
+	int64_t size;
+	// input history of the chunk for the section filtering it next
+	sf_sample_st xn1;
+	sf_sample_st xn2;
+	// real history just before the chunk of the section that filtered it last, which the start of
+	// the chunk is filtered again from
+	sf_sample_st hx1;
+	sf_sample_st hx2;
+	sf_sample_st yn1;
+	sf_sample_st yn2;
+	// outputs at the end of the chunk, filtered with zero output history
+	sf_sample_st zn1;
+	sf_sample_st zn2;
+	// copy of the input at the start of the chunk, saved before it's filtered with zero output
+	// history
+	sf_sample_st *head;
+	int64_t headlen;
+} chunk_st;
+
+// the work for one chunk in one round: filter the start of the chunk again with the previous
+// section, optionally reverse it, then filter it with the next section
+typedef struct {
+	chunk_st *chunk;
+	const sf_biquad_state_st *prev; // NULL in the first round
+	const sf_biquad_state_st *next; // NULL in the last round
+	sf_sample_st *input;
+	sf_sample_st *output;
+	bool exact;   // `prev` filtered the chunk with its real history, so its start is already right
+	bool first;   // filter the chunk with the real history in `next`
+	bool reverse; // reverse the chunk in place after filtering its start again
+	pthread_t thread;
+	bool spawned;
+} job_st;
+
+static void reverse(sf_sample_st *samples, int64_t size){
+	for (int64_t i = 0, j = size - 1; i < j; i++, j--){
+		sf_sample_st t = samples[i];
+		samples[i] = samples[j];
+		samples[j] = t;
+	}
+}
+
+static void run_job(job_st *job){
+	chunk_st *c = job->chunk;
+	sf_sample_st *out = &job->output[c->start];
+	if (job->prev && !job->exact){
+		// the outputs were found without the real output history, so they're wrong until the
+		// response of the biquad to that history dies out; filter the start of the chunk again from
+		// the real history, instead of adding the response back, since both can be far larger than
+		// the sound and cancel out (losing most of the precision) for a pole near the unit circle
+		sf_biquad_state_st st = *job->prev;
+		st.xn1 = c->hx1;
+		st.xn2 = c->hx2;
+		st.yn1 = c->yn1;
+		st.yn2 = c->yn2;
+		sf_biquad_process(&st, c->headlen, c->head, out);
+	}
+	if (job->reverse)
+		reverse(out, c->size);
+	if (job->next){
+		sf_biquad_state_st st = *job->next;
+		sf_sample_st *in = job->reverse ? out : &job->input[c->start];
+		if (!job->first){
+			memcpy(c->head, in, sizeof(sf_sample_st) * c->headlen);
+			c->hx1 = st.xn1 = c->xn1;
+			c->hx2 = st.xn2 = c->xn2;
+			st.yn1 = (sf_sample_st){ 0, 0 };
+			st.yn2 = (sf_sample_st){ 0, 0 };
+		}
+		sf_biquad_process(&st, c->size, in, out);
+		c->zn1 = st.yn1;
+		c->zn2 = st.yn2;
+	}
+}
+
+static void *job_main(void *arg){
+	run_job((job_st *)arg);
+	return NULL;
+}
+
+// run the jobs at the same time; the calling thread runs the first one, and any that can't get a
+// thread of their own
+static void run_round(job_st *jobs, int count){
+	for (int i = 1; i < count; i++)
+		jobs[i].spawned = pthread_create(&jobs[i].thread, NULL, job_main, &jobs[i]) == 0;
+	run_job(&jobs[0]);
+	for (int i = 1; i < count; i++){
+		if (jobs[i].spawned)
+			pthread_join(jobs[i].thread, NULL);
+		else
+			run_job(&jobs[i]);
+	}
+}
+
+// m = the matrix that takes the outputs (yn1, yn2) before `size` samples of the biquad's feedback
+// alone to the outputs at the end, found by repeated squaring
+static void feedback_matrix(const sf_biquad_state_st *bq, int64_t size, double m[4]){
+	double a[4] = { -bq->a1, -bq->a2, 1, 0 };
+	m[0] = 1; m[1] = 0; m[2] = 0; m[3] = 1;
+	while (size > 0){
+		if (size & 1){
+			double r[4] = {
+				m[0] * a[0] + m[1] * a[2], m[0] * a[1] + m[1] * a[3],
+				m[2] * a[0] + m[3] * a[2], m[2] * a[1] + m[3] * a[3]
+			};
+			m[0] = r[0]; m[1] = r[1]; m[2] = r[2]; m[3] = r[3];
+		}
+		double s[4] = {
+			a[0] * a[0] + a[1] * a[2], a[0] * a[1] + a[1] * a[3],
+			a[2] * a[0] + a[3] * a[2], a[2] * a[1] + a[3] * a[3]
+		};
+		a[0] = s[0]; a[1] = s[1]; a[2] = s[2]; a[3] = s[3];
+		size >>= 1;
+	}
+}
+
+// after a round has filtered every chunk with `bq`, walk the chunks in order (or backwards, from
+// the last one) to find the real outputs before each chunk, and save the real outputs at the end
+// in `bq`
+static void propagate(sf_biquad_state_st *bq, chunk_st *chunks, int count, bool backward){
+	// the first chunk was filtered with its real history
+	chunk_st *c = &chunks[backward ? count - 1 : 0];
+	sf_sample_st yn1 = c->zn1;
+	sf_sample_st yn2 = c->zn2;
+	for (int i = 1; i < count; i++){
+		c = &chunks[backward ? count - 1 - i : i];
+		c->yn1 = yn1;
+		c->yn2 = yn2;
+		double m[4];
+		feedback_matrix(bq, c->size, m);
+		sf_sample_st y1 = {
+			(float)(c->zn1.L + m[0] * yn1.L + m[1] * yn2.L),
+			(float)(c->zn1.R + m[0] * yn1.R + m[1] * yn2.R)
+		};
+		sf_sample_st y2 = {
+			(float)(c->zn2.L + m[2] * yn1.L + m[3] * yn2.L),
+			(float)(c->zn2.R + m[2] * yn1.R + m[3] * yn2.R)
+		};
+		yn1 = y1;
+		yn2 = y2;
+	}
+	// only the start of the last chunk is filtered again, so the outputs it wrote at its end are
+	// the real ones; use those instead of the sums above, so the history matches the output exactly
+	// and the next call carries on without a step
+	bq->yn1 = c->zn1;
+	bq->yn2 = c->zn2;
+}
+
+// split `size` samples into chunks of at least `minchunk` samples, one per thread
+// returns the number of chunks
+static int split(chunk_st *chunks, int64_t size, int threads, int64_t minchunk){
+	int64_t most = size / minchunk;
+	if (threads > SF_OFFLINE_MAXTHREADS)
+		threads = SF_OFFLINE_MAXTHREADS;
+	int count = most < threads ? (int)most : threads;
+	if (count < 1)
+		count = 1;
+	for (int i = 0; i < count; i++){
+		chunk_st *c = &chunks[i];
+		c->start = size * i / count;
+		c->size = size * (i + 1) / count - c->start;
+	}
+	return count;
+}
+
+// shortest chunk worth splitting off, when the start of each chunk is filtered again for `headlen`
+// samples: the start is only right if the rest of the chunk runs past it, and filtering more than
+// half of each chunk twice wouldn't save much time over one thread
+static int64_t minchunk(int64_t headlen){
+	return headlen * 2 > SF_OFFLINE_MINCHUNK ? headlen * 2 : SF_OFFLINE_MINCHUNK;
+}
+
+// number of samples until the response of the biquad's feedback alone, to outputs before the chunk
+// no bigger than 1, dies out below SF_OFFLINE_EPSILON (at most `most`)
+static int64_t settle(const sf_biquad_state_st *bq, int64_t most){
+	double a1 = bq->a1;
+	double a2 = bq->a2;
+	// the responses to the outputs (1, 0) and (0, 1)
+	double p1 = 1, p2 = 0, q1 = 0, q2 = 1;
+	for (int64_t n = 0; n < most; n++){
+		double p = -a1 * p1 - a2 * p2;
+		double q = -a1 * q1 - a2 * q2;
+		p2 = p1;
+		p1 = p;
+		q2 = q1;
+		q1 = q;
+		if (fabs(p1) + fabs(p2) + fabs(q1) + fabs(q2) < SF_OFFLINE_EPSILON)
+			return n + 1;
+	}
+	return most;
+}
+
+// longest that any section in `sections` takes to settle, up to `most` samples
+static int64_t settle_all(const sf_biquad_state_st *sections, int count, int64_t most){
+	int64_t headlen = 0;
+	for (int s = 0; s < count; s++){
+		int64_t h = settle(&sections[s], most);
+		if (h > headlen)
+			headlen = h;
+	}
+	return headlen;
+}
+
+// give each chunk room to save the first `headlen` samples of its input
+// returns the memory to free afterwards, or NULL if it can't be allocated
+static sf_sample_st *alloc_heads(chunk_st *chunks, int nchunks, int64_t headlen){
+	sf_sample_st *heads = (sf_sample_st *)sf_malloc(sizeof(sf_sample_st) * headlen * nchunks);
+	if (heads == NULL)
+		return NULL;
+	for (int i = 0; i < nchunks; i++){
+		chunk_st *c = &chunks[i];
+		c->head = &heads[headlen * i];
+		c->headlen = headlen < c->size ? headlen : c->size;
+	}
+	return heads;
+}
+
+// filter the sound through each section in turn, split into chunks
+// returns false if the sound is too short to split (for how long the sections ring), or the starts
+// of the chunks can't be saved, before touching anything
+static bool run(sf_biquad_state_st *sections, int count, int64_t size, sf_sample_st *input,
+	sf_sample_st *output, int threads){
+	chunk_st chunks[SF_OFFLINE_MAXTHREADS];
+	job_st jobs[SF_OFFLINE_MAXTHREADS];
+	// past a quarter of the sound, there's no room for two chunks anyway
+	int64_t headlen = settle_all(sections, count, size / 4 + 1);
+	int nchunks = split(chunks, size, threads, minchunk(headlen));
+	if (nchunks < 2)
+		return false;
+	sf_sample_st *heads = alloc_heads(chunks, nchunks, headlen);
+	if (heads == NULL)
+		return false;
+
+	// the input history of each chunk in the first round is the input before it, which has to be
+	// saved before any of it is overwritten, in case the input and output are the same buffer
+	for (int i = 1; i < nchunks; i++){
+		chunks[i].xn1 = input[chunks[i].start - 1];
+		chunks[i].xn2 = input[chunks[i].start - 2];
+	}
+	sf_sample_st xn1 = input[size - 1];
+	sf_sample_st xn2 = input[size - 2];
+
+	// round `r` filters the start of the chunks again with section `r - 1`, and filters them with
+	// section `r`
+	for (int r = 0; r <= count; r++){
+		for (int i = 0; i < nchunks; i++){
+			job_st *job = &jobs[i];
+			job->chunk = &chunks[i];
+			job->prev = r > 0 ? &sections[r - 1] : NULL;
+			job->next = r < count ? &sections[r] : NULL;
+			job->input = r > 0 ? output : input;
+			job->output = output;
+			job->exact = i == 0;
+			job->first = i == 0;
+			job->reverse = false;
+		}
+		run_round(jobs, nchunks);
+		if (r < count){
+			propagate(&sections[r], chunks, nchunks, false);
+			sections[r].xn1 = xn1;
+			sections[r].xn2 = xn2;
+			// the real output of this section is the input history of the next one
+			for (int i = 1; i < nchunks; i++){
+				chunks[i].xn1 = chunks[i].yn1;
+				chunks[i].xn2 = chunks[i].yn2;
+			}
+			xn1 = sections[r].yn1;
+			xn2 = sections[r].yn2;
+		}
+	}
+	sf_free(heads);
+	return true;
+}
+
+void sf_biquad_process_parallel(sf_biquad_state_st *state, int64_t size, sf_sample_st *input,
+	sf_sample_st *output, int threads){
+	if (!run(state, 1, size, input, output, threads))
+		sf_biquad_process(state, size, input, output);
+}
+
+void sf_biquad_chain_process_parallel(sf_biquad_chain_st *chain, int64_t size,
+	sf_sample_st *input, sf_sample_st *output, int threads){
+	if (chain->size <= 0 || !run(chain->sections, chain->size, size, input, output, threads))
+		sf_biquad_chain_process(chain, size, input, output);
+}
+
+// set the history of the biquad as if `x` had been its input forever
+static void steady(sf_biquad_state_st *bq, sf_sample_st x){
+	double den = 1.0 + bq->a1 + bq->a2;
+	double gain = den == 0 ? 0 : (bq->b0 + bq->b1 + bq->b2) / den;
+	bq->xn1 = bq->xn2 = x;
+	bq->yn1.L = bq->yn2.L = (float)(x.L * gain);
+	bq->yn1.R = bq->yn2.R = (float)(x.R * gain);
+}
+
+void sf_biquad_filtfilt(const sf_biquad_state_st *design, int64_t size, sf_sample_st *samples,
+	int threads){
+	if (size <= 0)
+		return;
+	chunk_st chunks[SF_OFFLINE_MAXTHREADS];
+	job_st jobs[SF_OFFLINE_MAXTHREADS];
+	int64_t headlen = settle(design, size / 4 + 1);
+	int nchunks = split(chunks, size, threads, minchunk(headlen));
+	sf_sample_st *heads = NULL;
+	if (nchunks > 1){
+		heads = alloc_heads(chunks, nchunks, headlen);
+		if (heads == NULL)
+			nchunks = split(chunks, size, 1, SF_OFFLINE_MINCHUNK);
+	}
+	for (int i = 1; i < nchunks; i++){
+		chunks[i].xn1 = samples[chunks[i].start - 1];
+		chunks[i].xn2 = samples[chunks[i].start - 2];
+	}
+	sf_sample_st xn1 = samples[size - 1];
+	sf_sample_st xn2 = size > 1 ? samples[size - 2] : xn1;
+
+	// the padding is the sound mirrored around its first (or last) sample, and turned upside down,
+	// which continues its slope past the edge; `pad` holds the padding at the start while it warms
+	// up the forward pass, then the padding at the end
+	sf_sample_st pad[SF_OFFLINE_PADLEN];
+	int64_t padlen = size - 1 < SF_OFFLINE_PADLEN ? size - 1 : SF_OFFLINE_PADLEN;
+	sf_sample_st x0 = samples[0];
+	for (int64_t k = 0; k < padlen; k++){
+		sf_sample_st x = samples[padlen - k];
+		pad[k] = (sf_sample_st){ 2 * x0.L - x.L, 2 * x0.R - x.R };
+	}
+	sf_biquad_state_st fw = *design;
+	steady(&fw, padlen > 0 ? pad[0] : x0);
+	sf_biquad_process(&fw, padlen, pad, pad);
+	sf_sample_st xe = samples[size - 1];
+	for (int64_t k = 0; k < padlen; k++){
+		sf_sample_st x = samples[size - 2 - k];
+		pad[k] = (sf_sample_st){ 2 * xe.L - x.L, 2 * xe.R - x.R };
+	}
+
+	// first round: filter the chunks forwards
+	for (int i = 0; i < nchunks; i++){
+		job_st *job = &jobs[i];
+		job->chunk = &chunks[i];
+		job->prev = NULL;
+		job->next = &fw;
+		job->input = samples;
+		job->output = samples;
+		job->exact = false;
+		job->first = i == 0;
+		job->reverse = false;
+	}
+	run_round(jobs, nchunks);
+	propagate(&fw, chunks, nchunks, false);
+	fw.xn1 = xn1;
+	fw.xn2 = xn2;
+
+	// the backward pass reads the sound in reverse, so the input history of each chunk is the real
+	// forward output at the start of the chunk after it, which is found here from its saved input
+	// before the next round starts changing it
+	for (int i = 0; i < nchunks - 1; i++){
+		const chunk_st *c = &chunks[i + 1];
+		sf_biquad_state_st st = fw;
+		st.xn1 = c->hx1;
+		st.xn2 = c->hx2;
+		st.yn1 = c->yn1;
+		st.yn2 = c->yn2;
+		sf_sample_st y[2];
+		sf_biquad_process(&st, 2, c->head, y);
+		chunks[i].xn1 = y[0];
+		chunks[i].xn2 = y[1];
+	}
+
+	// run the forward pass over the padding at the end, then the backward pass back over it, which
+	// leaves the backward pass warmed up at the end of the sound
+	sf_biquad_process(&fw, padlen, pad, pad);
+	reverse(pad, padlen);
+	sf_biquad_state_st bw = *design;
+	steady(&bw, padlen > 0 ? pad[0] : fw.yn1);
+	sf_biquad_process(&bw, padlen, pad, pad);
+
+	// second round: filter the start of the chunks again with the forward pass, reverse them, and
+	// filter them with the backward pass, where the last chunk comes first
+	for (int i = 0; i < nchunks; i++){
+		job_st *job = &jobs[i];
+		job->prev = &fw;
+		job->next = &bw;
+		job->exact = i == 0;
+		job->first = i == nchunks - 1;
+		job->reverse = true;
+	}
+	run_round(jobs, nchunks);
+	propagate(&bw, chunks, nchunks, true);
+
+	// last round: filter the start of the chunks again with the backward pass, and put them back in
+	// order
+	for (int i = 0; i < nchunks; i++){
+		job_st *job = &jobs[i];
+		job->prev = &bw;
+		job->next = NULL;
+		job->exact = i == nchunks - 1;
+	}
+	run_round(jobs, nchunks);
+	sf_free(heads);
+}
@@ -0,0 +1,94 @@
+//
+// sndfilter - Algorithms for sound filters, like reverb, lowpass, etc
+// by Sean Connelly (@velipso), https://sean.fun
+// Project Home: https://github.com/velipso/sndfilter
+// SPDX-License-Identifier: 0BSD
+//
+
+// offline processing: filtering a whole sound that's already in memory, using multiple threads
+
+#ifndef SNDFILTER_OFFLINE__H
+#define SNDFILTER_OFFLINE__H
+
+#include "biquad.h"
+
+// a biquad is recursive, so filtering one sound is serial: each output depends on the one before
+// it; but it's also linear, so the sound can be split into chunks that are all filtered at the same
+// time as if the filter started from silence, and then fixed up afterwards:
+//
+//   1. each thread saves the input at the start of its chunk, then filters the chunk with the
+//      biquad's outputs before the chunk set to zero
+//   2. walking the chunks in order, the real outputs at the end of each chunk are found from the
+//      ones at the end of the chunk before it (a few multiplies per chunk)
+//   3. the outputs from step 1 are only wrong until the response of the biquad to the real outputs
+//      before the chunk dies out, so each thread filters that much of the start of its chunk again,
+//      from the saved input and the real history before it
+//
+// the time is close to one pass divided by the number of threads, plus filtering the start of each
+// chunk twice; that's however long the biquad rings for, which is a few hundred samples for most
+// designs, but can be tens of thousands for a low highpass or a narrow bass peak, and is held in
+// one allocation for all the chunks
+//
+// a chunk is only split off when it's at least twice as long as that, so its start is filtered
+// from the real history and its end is exactly what it wrote; a biquad that rings too long for the
+// sound uses fewer threads, or just one (as does a failed allocation), and the results are as
+// accurate as sf_biquad_process either way (see test/sfcheck.cpp)
+//
+// for example, to filter a whole sound on 4 threads:
+//
+//   sf_biquad_state_st lowpass;
+//   sf_lowpass(&lowpass, snd->rate, 440, 1);
+//   sf_biquad_process_parallel(&lowpass, snd->size, snd->samples, snd->samples, 4);
+
+// most threads used at once (and chunks the sound is split into)
+#ifndef SF_OFFLINE_MAXTHREADS
+#	define SF_OFFLINE_MAXTHREADS  16
+#endif
+
+// fewest samples in a chunk (or twice how long the biquad rings, if that's longer); shorter sounds
+// are split across fewer threads (or just one)
+#ifndef SF_OFFLINE_MINCHUNK
+#	define SF_OFFLINE_MINCHUNK  16384
+#endif
+
+// step 3 stops once the response of the biquad has decayed below this level, which is far below
+// anything audible or representable in a 24-bit file
+#ifndef SF_OFFLINE_EPSILON
+#	define SF_OFFLINE_EPSILON  1e-10f
+#endif
+
+// samples of padding added to each end of the sound by sf_biquad_filtfilt (held on the stack)
+#ifndef SF_OFFLINE_PADLEN
+#	define SF_OFFLINE_PADLEN  256
+#endif
+
+// same as sf_biquad_process, but splitting the sound across up to `threads` threads
+// the input and output buffers should be the same size, and can be the same buffer (but shouldn't
+// otherwise overlap)
+void sf_biquad_process_parallel(sf_biquad_state_st *state, int64_t size, sf_sample_st *input,
+	sf_sample_st *output, int threads);
+
+// same as sf_biquad_chain_process, but splitting the sound across up to `threads` threads
+// the input and output buffers should be the same size, and can be the same buffer (but shouldn't
+// otherwise overlap)
+void sf_biquad_chain_process_parallel(sf_biquad_chain_st *chain, int64_t size,
+	sf_sample_st *input, sf_sample_st *output, int threads);
+
+// zero-phase filtering: filter the sound in place forwards, then backwards with the same biquad,
+// which cancels out the phase shift and doubles the effect on the magnitude (so a lowpass with a
+// resonance of 0.7 falls off twice as steeply past the cutoff, without smearing transients)
+//
+// the sound is padded at each end, so the filter settles before the edges instead of ringing at
+// them, and the chunks are reversed in place for the backward pass, so only the saved starts of the
+// chunks are allocated; filtering the start of the chunks again for the forward pass and filtering
+// them for the backward pass run in the same round, which makes the time close to two passes
+// divided by the number of threads
+//
+// the chunks are split the same way as sf_biquad_process_parallel, and both passes continue from
+// the outputs they really wrote, so the results only differ between numbers of threads by rounding
+//
+// only the coefficients of `design` are used; its history is left alone
+void sf_biquad_filtfilt(const sf_biquad_state_st *design, int64_t size, sf_sample_st *samples,
+	int threads);
+
+#endif // SNDFILTER_OFFLINE__H
@@ -0,0 +1,241 @@
+//
+// sndfilter - Algorithms for sound filters, like reverb, lowpass, etc
+// by Sean Connelly (@velipso), https://sean.fun
+// Project Home: https://github.com/velipso/sndfilter
+// SPDX-License-Identifier: 0BSD
+//
+
+#include "pipeline.h"
+#include "mem.h"
+#include <pthread.h>
+#include <string.h>
+
+// a block of samples moving through the pipeline; a size of 0 marks the end of the stream
+typedef struct {
+	sf_sample_st *samples;
+	int64_t size;
+} block_st;
+
+// bounded FIFO of blocks, safe to use from multiple threads
+typedef struct {
+	block_st **items;
+	int cap;
+	int head;
+	int count;
+	pthread_mutex_t lock;
+	pthread_cond_t notempty;
+	pthread_cond_t notfull;
+} queue_st;
+
+typedef struct {
+	sf_wavreader_st *rd;
+	sf_wavwriter_st *wr;
+	int64_t tailsmp;
+	int blocksize;
+	bool stop;          // set when either side fails, so the reader quits early
+	bool readerr;
+	bool writeerr;
+	queue_st freein;  // empty input blocks, waiting for the reader
+	queue_st fullin;  // decoded input blocks, waiting for the filter
+	queue_st freeout; // empty output blocks, waiting for the filter
+	queue_st fullout; // filtered output blocks, waiting for the writer
+} pipeline_st;
+
+static bool queue_init(queue_st *q, int cap){
+	q->items = (block_st **)sf_malloc(sizeof(block_st *) * cap);
+	if (q->items == NULL)
+		return false;
+	q->cap = cap;
+	q->head = 0;
+	q->count = 0;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->notempty, NULL);
+	pthread_cond_init(&q->notfull, NULL);
+	return true;
+}
+
+static void queue_destroy(queue_st *q){
+	if (q->items == NULL)
+		return;
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->notempty);
+	pthread_cond_destroy(&q->notfull);
+	sf_free(q->items);
+}
+
+static void queue_push(queue_st *q, block_st *b){
+	pthread_mutex_lock(&q->lock);
+	while (q->count >= q->cap)
+		pthread_cond_wait(&q->notfull, &q->lock);
+	q->items[(q->head + q->count) % q->cap] = b;
+	q->count++;
+	pthread_cond_signal(&q->notempty);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static block_st *queue_pop(queue_st *q){
+	pthread_mutex_lock(&q->lock);
+	while (q->count <= 0)
+		pthread_cond_wait(&q->notempty, &q->lock);
+	block_st *b = q->items[q->head];
+	q->head = (q->head + 1) % q->cap;
+	q->count--;
+	pthread_cond_signal(&q->notfull);
+	pthread_mutex_unlock(&q->lock);
+	return b;
+}
+
+static inline bool stopped(pipeline_st *p){
+	return __atomic_load_n(&p->stop, __ATOMIC_ACQUIRE);
+}
+
+static inline void setstop(pipeline_st *p){
+	__atomic_store_n(&p->stop, true, __ATOMIC_RELEASE);
+}
+
+// reader thread: decode the input into free blocks, then generate the silent tail
+static void *reader_main(void *arg){
+	pipeline_st *p = (pipeline_st *)arg;
+	int64_t tailsmp = p->tailsmp;
+	bool eof = false;
+	for (;;){
+		block_st *b = queue_pop(&p->freein);
+		b->size = 0;
+		if (stopped(p)){
+			queue_push(&p->fullin, b);
+			break;
+		}
+		if (!eof){
+			int64_t n = sf_wavreader_read(p->rd, p->blocksize, b->samples);
+			if (n < 0){
+				p->readerr = true;
+				setstop(p);
+				queue_push(&p->fullin, b);
+				break;
+			}
+			if (n > 0){
+				b->size = n;
+				queue_push(&p->fullin, b);
+				continue;
+			}
+			eof = true;
+		}
+		if (tailsmp > 0){
+			b->size = tailsmp < p->blocksize ? tailsmp : p->blocksize;
+			memset(b->samples, 0, sizeof(sf_sample_st) * b->size);
+			tailsmp -= b->size;
+			queue_push(&p->fullin, b);
+			continue;
+		}
+		queue_push(&p->fullin, b); // end of stream
+		break;
+	}
+	return NULL;
+}
+
+// writer thread: encode and write the filtered blocks, and hand them back
+static void *writer_main(void *arg){
+	pipeline_st *p = (pipeline_st *)arg;
+	for (;;){
+		block_st *b = queue_pop(&p->fullout);
+		if (b->size == 0)
+			break;
+		// after a failure, keep draining the queue so the other stages don't block
+		if (!p->writeerr && !sf_wavwriter_write(p->wr, b->size, b->samples)){
+			p->writeerr = true;
+			setstop(p);
+		}
+		queue_push(&p->freeout, b);
+	}
+	return NULL;
+}
+
+static bool spawn(pthread_t *thread, void *(*func)(void *), pipeline_st *p){
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	if (SF_PIPELINE_STACKSIZE > 0)
+		pthread_attr_setstacksize(&attr, SF_PIPELINE_STACKSIZE);
+	bool ok = pthread_create(thread, &attr, func, p) == 0;
+	pthread_attr_destroy(&attr);
+	return ok;
+}
+
+// start the threads and run the filter on the calling thread until the end of the stream
+static sf_pipeline_result run(pipeline_st *p, sf_pipeline_func process, void *state){
+	pthread_t reader, writer;
+	if (!spawn(&reader, reader_main, p))
+		return SF_PIPELINE_NOMEM;
+	if (!spawn(&writer, writer_main, p)){
+		// stop the reader, and drain its queue until it finishes
+		setstop(p);
+		for (;;){
+			block_st *b = queue_pop(&p->fullin);
+			bool end = b->size == 0;
+			queue_push(&p->freein, b);
+			if (end)
+				break;
+		}
+		pthread_join(reader, NULL);
+		return SF_PIPELINE_NOMEM;
+	}
+
+	for (;;){
+		block_st *in = queue_pop(&p->fullin);
+		block_st *out = queue_pop(&p->freeout);
+		out->size = in->size;
+		if (in->size > 0)
+			process(state, in->size, in->samples, out->samples);
+		queue_push(&p->freein, in);
+		queue_push(&p->fullout, out);
+		if (out->size == 0)
+			break;
+	}
+
+	pthread_join(reader, NULL);
+	pthread_join(writer, NULL);
+	if (p->readerr)
+		return SF_PIPELINE_READERR;
+	if (p->writeerr)
+		return SF_PIPELINE_WRITEERR;
+	return SF_PIPELINE_OK;
+}
+
+sf_pipeline_result sf_pipeline(sf_wavreader_st *rd, sf_wavwriter_st *wr, sf_pipeline_func process,
+	void *state, int64_t tailsmp, int blocksize, int depth){
+	if (blocksize <= 0 || depth <= 0)
+		return SF_PIPELINE_NOMEM;
+
+	pipeline_st p;
+	memset(&p, 0, sizeof(p));
+	p.rd = rd;
+	p.wr = wr;
+	p.tailsmp = tailsmp;
+	p.blocksize = blocksize;
+
+	// allocate `depth` blocks on each side of the filter, each one starting on a cache line
+	sf_pipeline_result res = SF_PIPELINE_NOMEM;
+	int nblocks = depth * 2;
+	size_t stride = sf_alignsize(sizeof(sf_sample_st) * blocksize);
+	block_st *blocks = (block_st *)sf_malloc(sizeof(block_st) * nblocks);
+	uint8_t *mem = (uint8_t *)sf_aligned_malloc(stride * nblocks, SF_ALIGN);
+	if (blocks && mem &&
+		queue_init(&p.freein, depth) && queue_init(&p.fullin, depth) &&
+		queue_init(&p.freeout, depth) && queue_init(&p.fullout, depth)){
+		for (int i = 0; i < nblocks; i++){
+			blocks[i].samples = (sf_sample_st *)(mem + stride * i);
+			blocks[i].size = 0;
+			queue_push(i < depth ? &p.freein : &p.freeout, &blocks[i]);
+		}
+		res = run(&p, process, state);
+	}
+
+	queue_destroy(&p.freein);
+	queue_destroy(&p.fullin);
+	queue_destroy(&p.freeout);
+	queue_destroy(&p.fullout);
+	if (blocks)
+		sf_free(blocks);
+	if (mem)
+		sf_aligned_free(mem);
+	return res;
+}
@@ -0,0 +1,62 @@
+//
+// sndfilter - Algorithms for sound filters, like reverb, lowpass, etc
+// by Sean Connelly (@velipso), https://sean.fun
+// Project Home: https://github.com/velipso/sndfilter
+// SPDX-License-Identifier: 0BSD
+//
+
+// pipelined streaming: overlap WAV reading, filtering, and WAV writing on separate threads
+
+#ifndef SNDFILTER_PIPELINE__H
+#define SNDFILTER_PIPELINE__H
+
+#include "wav.h"
+
+// streaming a file through a filter one chunk at a time leaves the CPU idle while the disk is busy
+// and vice versa; the pipeline runs three stages at the same time instead:
+//
+//   reader thread    decodes the next blocks from the WAV file
+//   calling thread   runs the filter over each block
+//   writer thread    encodes and writes the filtered blocks
+//
+// the stages hand blocks to each other through bounded queues, so at most `depth` blocks are in
+// flight on each side of the filter, and the total time approaches the slowest stage instead of
+// the sum of all three
+//
+// for example:
+//
+//   sf_wavreader_st *rd = sf_wavreader_open("input.wav");
+//   sf_wavwriter_st *wr = sf_wavwriter_open("output.wav", sf_wavreader_rate(rd),
+//     sf_wavreader_size(rd));
+//   sf_pipeline(rd, wr, my_process, &state, 0, 4096, 4);
+//   sf_wavreader_close(rd);
+//   sf_wavwriter_close(wr);
+
+// stack size of the reader and writer threads (0 for the platform default)
+// the default pthread stack on ESP32 is too small for the SD library, so it gets a bigger one
+#ifndef SF_PIPELINE_STACKSIZE
+#	if defined(ARDUINO)
+#		define SF_PIPELINE_STACKSIZE  8192
+#	else
+#		define SF_PIPELINE_STACKSIZE  0
+#	endif
+#endif
+
+// filter callback; `size` is at most the block size, and smaller only for the last block
+typedef void (*sf_pipeline_func)(void *state, int64_t size, sf_sample_st *input,
+	sf_sample_st *output);
+
+typedef enum {
+	SF_PIPELINE_OK,
+	SF_PIPELINE_READERR,  // failed to read the input
+	SF_PIPELINE_WRITEERR, // failed to write the output
+	SF_PIPELINE_NOMEM     // failed to allocate the blocks or start the threads
+} sf_pipeline_result;
+
+// run `process` over every sample of `rd` in blocks of `blocksize` samples, followed by `tailsmp`
+// samples of silence, and write the results to `wr`
+// the output is identical to reading, processing, and writing each block in turn on one thread
+sf_pipeline_result sf_pipeline(sf_wavreader_st *rd, sf_wavwriter_st *wr, sf_pipeline_func process,
+	void *state, int64_t tailsmp, int blocksize, int depth);
+
+#endif // SNDFILTER_PIPELINE__H
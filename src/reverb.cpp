@@ -6,11 +6,23 @@
 //
 
 #include "reverb.h"
+#include "denormal.h"
+#include "mem.h"
 #include <math.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
 
+#ifdef SF_REVERB_PROFILE
+#	if defined(ESP_PLATFORM)
+#		include "esp_cpu.h"
+#	elif defined(__x86_64__) || defined(__i386__)
+#		include <x86intrin.h>
+#	else
+#		include <time.h>
+#	endif
+#endif
+
 // utility functions
 static inline float db2lin(float db){ // dB to linear
 	return powf(10.0f, 0.05f * db);
@@ -48,17 +60,56 @@ static inline int nextprime(int v){
 }
 
 // generate a random float [0, 1) using a simple (but good quality) RNG
-static inline float randfloat(){
-	static uint32_t seed = 123; // doesn't matter
-	static uint32_t i = 456; // doesn't matter
+static inline float randfloat(sf_rv_noise_st *noise){
 	uint32_t m = 0x5bd1e995;
-	uint32_t k = i++ * m;
-	seed = (k ^ (k >> 24) ^ (seed * m)) * m;
-	uint32_t R = (seed ^ (seed >> 13)) & 0x007FFFFF; // get 23 random bits
+	uint32_t k = noise->count++ * m;
+	noise->seed = (k ^ (k >> 24) ^ (noise->seed * m)) * m;
+	uint32_t R = (noise->seed ^ (noise->seed >> 13)) & 0x007FFFFF; // get 23 random bits
 	union { uint32_t i; float f; } u = { .i = 0x3F800000 | R };
 	return u.f - 1.0;
 }
 
+//
+// profiling
+//
+#ifdef SF_REVERB_PROFILE
+// read the fastest timer available; CPU cycles on ESP32 and x86, nanoseconds everywhere else
+#	if defined(ESP_PLATFORM)
+#		define PROF_CYCLES  true
+typedef uint32_t prof_tick; // the cycle counter is 32 bits, so deltas rely on unsigned wraparound
+static inline prof_tick prof_now(){
+	return (prof_tick)esp_cpu_get_cycle_count();
+}
+#	elif defined(__x86_64__) || defined(__i386__)
+#		define PROF_CYCLES  true
+typedef uint64_t prof_tick;
+static inline prof_tick prof_now(){
+	return __rdtsc();
+}
+#	else
+#		define PROF_CYCLES  false
+typedef uint64_t prof_tick;
+static inline prof_tick prof_now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (prof_tick)ts.tv_sec * 1000000000ull + (prof_tick)ts.tv_nsec;
+}
+#	endif
+
+// PROF_MARK charges the time since the previous mark to a stage
+#	define PROF_START()      prof_tick prof_last = prof_now()
+#	define PROF_MARK(stage)  do{                                   \
+		prof_tick prof_t = prof_now();                             \
+		rv->stats.ticks[stage] += (prof_tick)(prof_t - prof_last); \
+		prof_last = prof_t;                                        \
+	}while(0)
+#	define PROF_SAMPLES(n)   rv->stats.samples += (n)
+#else
+#	define PROF_START()
+#	define PROF_MARK(stage)
+#	define PROF_SAMPLES(n)
+#endif
+
 //
 //
 // component implementation
@@ -67,6 +118,56 @@ static inline float randfloat(){
 
 // components are in the basic format of `<component>_make` to initialize a structure and
 // `<component>_step` to perform a single step with the component
+//
+// `<component>_make` only picks the sizes of the buffers; reverb_layout assigns and clears them
+// once every component is made
+
+//
+// ring buffers
+//
+
+// number of floats in the buffer of a line of `size`
+static inline int ring_size(int size){
+#if SF_REVERB_POW2
+	int n = 1;
+	while (n < size)
+		n <<= 1;
+	return n;
+#else
+	return size;
+#endif
+}
+
+// the ring functions take the size of the line, which is also the size of its buffer unless
+// SF_REVERB_POW2 is set, in which case they only need the mask
+
+// index of the value written `age` steps before `pos`, for 1 <= age <= size
+static inline int ring_at(int pos, int age, int size, int mask){
+#if SF_REVERB_POW2
+	(void)size;
+	return (pos - age) & mask;
+#else
+	(void)mask;
+	int i = pos - age;
+	return i < 0 ? i + size : i;
+#endif
+}
+
+static inline int ring_next(int pos, int size, int mask){
+#if SF_REVERB_POW2
+	(void)size;
+	return (pos + 1) & mask;
+#else
+	(void)mask;
+	return pos + 1 >= size ? 0 : pos + 1;
+#endif
+}
+
+// age of the value returned by the `<component>_get` functions; offsets past the end of the line
+// return the oldest value
+static inline int ring_age(int offset, int size){
+	return offset < 1 ? 1 : offset > size ? size : offset;
+}
 
 //
 // delay
@@ -74,13 +175,13 @@ static inline float randfloat(){
 static inline void delay_make(sf_rv_delay_st *delay, int size){
 	delay->pos = 0;
 	delay->size = clampi(size, 1, SF_REVERB_DS);
-	memset(delay->buf, 0, sizeof(float) * delay->size);
+	delay->mask = ring_size(delay->size) - 1;
 }
 
 static inline float delay_step(sf_rv_delay_st *delay, float v){
-	float out = delay->buf[delay->pos];
+	float out = delay->buf[ring_at(delay->pos, delay->size, delay->size, delay->mask)];
 	delay->buf[delay->pos] = v;
-	delay->pos = (delay->pos + 1) % delay->size;
+	delay->pos = ring_next(delay->pos, delay->size, delay->mask);
 	return out;
 }
 
@@ -88,18 +189,11 @@ static inline float delay_step(sf_rv_delay_st *delay, float v){
 // delay_get(d, 2) returns the second-last written value
 // ..etc
 static inline float delay_get(sf_rv_delay_st *delay, int offset){
-	if (offset > delay->size)
-		return delay->buf[delay->pos];
-	else if (offset <= 0)
-		offset = 1;
-	int pos = delay->pos - offset;
-	if (pos < 0)
-		pos += delay->size;
-	return delay->buf[pos];
+	return delay->buf[ring_at(delay->pos, ring_age(offset, delay->size), delay->size, delay->mask)];
 }
 
 static inline float delay_getlast(sf_rv_delay_st *delay){
-	return delay->buf[delay->pos];
+	return delay->buf[ring_at(delay->pos, delay->size, delay->size, delay->mask)];
 }
 
 //
@@ -128,7 +222,7 @@ static inline void iir1_makeHPF(sf_rv_iir1_st *iir1, int rate, float freq){
 
 static inline float iir1_step(sf_rv_iir1_st *iir1, float v){
 	float out = v * iir1->b1 + iir1->y1;
-	iir1->y1 = out * iir1->a2 + v * iir1->b2;
+	iir1->y1 = sf_denormal_flush(out * iir1->a2 + v * iir1->b2);
 	return out;
 }
 
@@ -195,8 +289,8 @@ static inline void biquad_makeAPF(sf_rv_biquad_st *biquad, int rate, float freq,
 }
 
 static inline float biquad_step(sf_rv_biquad_st *biquad, float v){
-	float out = v * biquad->b0 + biquad->xn1 * biquad->b1 + biquad->xn2 * biquad->b2 -
-		biquad->yn1 * biquad->a1 - biquad->yn2 * biquad->a2;
+	float out = sf_denormal_flush(v * biquad->b0 + biquad->xn1 * biquad->b1 +
+		biquad->xn2 * biquad->b2 - biquad->yn1 * biquad->a1 - biquad->yn2 * biquad->a2);
 	biquad->xn2 = biquad->xn1;
 	biquad->xn1 = v;
 	biquad->yn2 = biquad->yn1;
@@ -322,7 +416,7 @@ static inline void dccut_make(sf_rv_dccut_st *dccut, int rate, float freq){
 }
 
 static inline float dccut_step(sf_rv_dccut_st *dccut, float v){
-	float out = v - dccut->y1 + dccut->gain * dccut->y2;
+	float out = sf_denormal_flush(v - dccut->y1 + dccut->gain * dccut->y2);
 	dccut->y1 = v;
 	dccut->y2 = out;
 	return out;
@@ -333,6 +427,8 @@ static inline float dccut_step(sf_rv_dccut_st *dccut, float v){
 //
 static inline void noise_make(sf_rv_noise_st *noise){
 	noise->pos = SF_REVERB_NS;
+	noise->seed = 123; // doesn't matter
+	noise->count = 456; // doesn't matter
 }
 
 static inline float noise_step(sf_rv_noise_st *noise){
@@ -350,7 +446,7 @@ static inline float noise_step(sf_rv_noise_st *noise){
 				float right = left;
 				left = noise->buf[i * len];
 				float midpoint = (left + right) * 0.5f;
-				float newv = midpoint + r * (2.0f * randfloat() - 1.0f); // displace by random amt
+				float newv = midpoint + r * (2.0f * randfloat(noise) - 1.0f); // displace by random amt
 				noise->buf[i * len + (len / 2)] = clampf(newv, -1.0f, 1.0f);
 			}
 			len /= 2;
@@ -396,16 +492,17 @@ static inline float lfo_step(sf_rv_lfo_st *lfo){
 static inline void allpass_make(sf_rv_allpass_st *allpass, int size, float feedback, float decay){
 	allpass->pos = 0;
 	allpass->size = clampi(size, 1, SF_REVERB_APS);
+	allpass->mask = ring_size(allpass->size) - 1;
 	allpass->feedback = feedback;
 	allpass->decay = decay;
-	memset(allpass->buf, 0, sizeof(float) * allpass->size);
 }
 
 static inline float allpass_step(sf_rv_allpass_st *allpass, float v){
-	v += allpass->feedback * allpass->buf[allpass->pos];
-	float out = allpass->decay * allpass->buf[allpass->pos] - allpass->feedback * v;
+	float last = allpass->buf[ring_at(allpass->pos, allpass->size, allpass->size, allpass->mask)];
+	v = sf_denormal_flush(v + allpass->feedback * last);
+	float out = allpass->decay * last - allpass->feedback * v;
 	allpass->buf[allpass->pos] = v;
-	allpass->pos = (allpass->pos + 1) % allpass->size;
+	allpass->pos = ring_next(allpass->pos, allpass->size, allpass->mask);
 	return out;
 }
 
@@ -418,46 +515,38 @@ static inline void allpass2_make(sf_rv_allpass2_st *allpass2, int size1, int siz
 	allpass2->pos2 = 0;
 	allpass2->size1 = clampi(size1, 1, SF_REVERB_AP2S1);
 	allpass2->size2 = clampi(size2, 1, SF_REVERB_AP2S2);
+	allpass2->mask1 = ring_size(allpass2->size1) - 1;
+	allpass2->mask2 = ring_size(allpass2->size2) - 1;
 	allpass2->feedback1 = feedback1;
 	allpass2->feedback2 = feedback2;
 	allpass2->decay1 = decay1;
 	allpass2->decay2 = decay2;
-	memset(allpass2->buf1, 0, sizeof(float) * allpass2->size1);
-	memset(allpass2->buf2, 0, sizeof(float) * allpass2->size2);
 }
 
 static inline float allpass2_step(sf_rv_allpass2_st *allpass2, float v){
-	v += allpass2->feedback2 * allpass2->buf2[allpass2->pos2];
-	float out = allpass2->decay2 * allpass2->buf2[allpass2->pos2] - v * allpass2->feedback2;
-	v += allpass2->feedback1 * allpass2->buf1[allpass2->pos1];
-	allpass2->buf2[allpass2->pos2] = allpass2->decay1 * allpass2->buf1[allpass2->pos1] -
-		v * allpass2->feedback1;
+	float last1 = allpass2->buf1[ring_at(allpass2->pos1, allpass2->size1, allpass2->size1,
+		allpass2->mask1)];
+	float last2 = allpass2->buf2[ring_at(allpass2->pos2, allpass2->size2, allpass2->size2,
+		allpass2->mask2)];
+	v += allpass2->feedback2 * last2;
+	float out = allpass2->decay2 * last2 - v * allpass2->feedback2;
+	v = sf_denormal_flush(v + allpass2->feedback1 * last1);
+	allpass2->buf2[allpass2->pos2] =
+		sf_denormal_flush(allpass2->decay1 * last1 - v * allpass2->feedback1);
 	allpass2->buf1[allpass2->pos1] = v;
-	allpass2->pos1 = (allpass2->pos1 + 1) % allpass2->size1;
-	allpass2->pos2 = (allpass2->pos2 + 1) % allpass2->size2;
+	allpass2->pos1 = ring_next(allpass2->pos1, allpass2->size1, allpass2->mask1);
+	allpass2->pos2 = ring_next(allpass2->pos2, allpass2->size2, allpass2->mask2);
 	return out;
 }
 
 static inline float allpass2_get1(sf_rv_allpass2_st *allpass2, int offset){
-	if (offset > allpass2->size1)
-		return allpass2->buf1[allpass2->pos1];
-	else if (offset <= 0)
-		offset = 1;
-	int rp = allpass2->pos1 - offset;
-	if (rp < 0)
-		rp += allpass2->size1;
-	return allpass2->buf1[rp];
+	return allpass2->buf1[ring_at(allpass2->pos1, ring_age(offset, allpass2->size1),
+		allpass2->size1, allpass2->mask1)];
 }
 
 static inline float allpass2_get2(sf_rv_allpass2_st *allpass2, int offset){
-	if (offset > allpass2->size2)
-		return allpass2->buf2[allpass2->pos2];
-	else if (offset <= 0)
-		offset = 1;
-	int rp = allpass2->pos2 - offset;
-	if (rp < 0)
-		rp += allpass2->size2;
-	return allpass2->buf2[rp];
+	return allpass2->buf2[ring_at(allpass2->pos2, ring_age(offset, allpass2->size2),
+		allpass2->size2, allpass2->mask2)];
 }
 
 //
@@ -471,82 +560,73 @@ static inline void allpass3_make(sf_rv_allpass3_st *allpass3, int size1, int msi
 	if (msize1 > size1)
 		msize1 = size1;
 	int newsize = size1 + msize1;
-	allpass3->rpos1 = (msize1 * 2) % newsize;
-	allpass3->wpos1 = 0;
+	allpass3->pos1 = 0;
+	allpass3->rdist1 = newsize - (msize1 * 2) % newsize;
 	allpass3->pos2 = 0;
 	allpass3->pos3 = 0;
 	allpass3->size1 = newsize;
 	allpass3->msize1 = msize1;
 	allpass3->size2 = clampi(size2, 1, SF_REVERB_AP3S2);
 	allpass3->size3 = clampi(size3, 1, SF_REVERB_AP3S3);
+	allpass3->mask1 = ring_size(allpass3->size1) - 1;
+	allpass3->mask2 = ring_size(allpass3->size2) - 1;
+	allpass3->mask3 = ring_size(allpass3->size3) - 1;
 	allpass3->feedback1 = feedback1;
 	allpass3->feedback2 = feedback2;
 	allpass3->feedback3 = feedback3;
 	allpass3->decay1 = decay1;
 	allpass3->decay2 = decay2;
 	allpass3->decay3 = decay3;
-	memset(allpass3->buf1, 0, sizeof(float) * allpass3->size1);
-	memset(allpass3->buf2, 0, sizeof(float) * allpass3->size2);
-	memset(allpass3->buf3, 0, sizeof(float) * allpass3->size3);
 }
 
 static inline float allpass3_step(sf_rv_allpass3_st *allpass3, float v, float mod){
 	mod = (mod + 1.0f) * (float)allpass3->msize1;
 	float floormod = floorf(mod);
 	float mfrac = mod - floormod;
-	int rpos1 = allpass3->rpos1 - (int)floormod;
-	if (rpos1 < 0)
-		rpos1 += allpass3->size1;
-	int rpos2 = rpos1 - 1;
-	if (rpos2 < 0)
-		rpos2 += allpass3->size1;
-	v += allpass3->feedback3 * allpass3->buf3[allpass3->pos3];
-	float out = allpass3->decay3 * allpass3->buf3[allpass3->pos3] - allpass3->feedback3 * v;
-	v += allpass3->feedback2 * allpass3->buf2[allpass3->pos2];
-	allpass3->buf3[allpass3->pos3] = allpass3->decay2 * allpass3->buf2[allpass3->pos2] -
-		allpass3->feedback2 * v;
-	float tmp = allpass3->buf1[rpos2] * mfrac + allpass3->buf1[rpos1] * (1.0f - mfrac);
-	v += allpass3->feedback1 * tmp;
-	allpass3->buf2[allpass3->pos2] = allpass3->decay1 * tmp - allpass3->feedback1 * v;
-	allpass3->buf1[allpass3->wpos1] = v;
-	allpass3->wpos1 = (allpass3->wpos1 + 1) % allpass3->size1;
-	allpass3->rpos1 = (allpass3->rpos1 + 1) % allpass3->size1;
-	allpass3->pos2 = (allpass3->pos2 + 1) % allpass3->size2;
-	allpass3->pos3 = (allpass3->pos3 + 1) % allpass3->size3;
+	int size1 = allpass3->size1;
+	int age1 = allpass3->rdist1 + (int)floormod;
+	if (age1 > size1)
+		age1 -= size1;
+	int age2 = age1 + 1;
+	if (age2 > size1)
+		age2 -= size1;
+	float last2 = allpass3->buf2[ring_at(allpass3->pos2, allpass3->size2, allpass3->size2,
+		allpass3->mask2)];
+	float last3 = allpass3->buf3[ring_at(allpass3->pos3, allpass3->size3, allpass3->size3,
+		allpass3->mask3)];
+	v += allpass3->feedback3 * last3;
+	float out = allpass3->decay3 * last3 - allpass3->feedback3 * v;
+	v += allpass3->feedback2 * last2;
+	allpass3->buf3[allpass3->pos3] =
+		sf_denormal_flush(allpass3->decay2 * last2 - allpass3->feedback2 * v);
+	float tmp = allpass3->buf1[ring_at(allpass3->pos1, age2, size1, allpass3->mask1)] * mfrac +
+		allpass3->buf1[ring_at(allpass3->pos1, age1, size1, allpass3->mask1)] * (1.0f - mfrac);
+	v = sf_denormal_flush(v + allpass3->feedback1 * tmp);
+	allpass3->buf2[allpass3->pos2] =
+		sf_denormal_flush(allpass3->decay1 * tmp - allpass3->feedback1 * v);
+	allpass3->buf1[allpass3->pos1] = v;
+	allpass3->pos1 = ring_next(allpass3->pos1, size1, allpass3->mask1);
+	allpass3->pos2 = ring_next(allpass3->pos2, allpass3->size2, allpass3->mask2);
+	allpass3->pos3 = ring_next(allpass3->pos3, allpass3->size3, allpass3->mask3);
 	return out;
 }
 
+// line 1 is read relative to its unmodulated read position
 static inline float allpass3_get1(sf_rv_allpass3_st *allpass3, int offset){
-	if (offset > allpass3->size1)
-		return allpass3->buf1[allpass3->rpos1];
-	else if (offset <= 0)
-		offset = 1;
-	int rp = allpass3->rpos1 - offset;
-	if (rp < 0)
-		rp += allpass3->size1;
-	return allpass3->buf1[rp];
+	int age = allpass3->rdist1 + ring_age(offset, allpass3->size1);
+	if (age > allpass3->size1)
+		age -= allpass3->size1;
+	return allpass3->buf1[ring_at(allpass3->pos1, age, allpass3->size1, allpass3->mask1)];
 }
 
 static inline float allpass3_get2(sf_rv_allpass3_st *allpass3, int offset){
-	if (offset > allpass3->size2)
-		return allpass3->buf2[allpass3->pos2];
-	else if (offset <= 0)
-		offset = 1;
-	int rp = allpass3->pos2 - offset;
-	if (rp < 0)
-		rp += allpass3->size2;
-	return allpass3->buf2[rp];
+	return allpass3->buf2[ring_at(allpass3->pos2, ring_age(offset, allpass3->size2),
+		allpass3->size2, allpass3->mask2)];
 }
 
 static inline float allpass3_get3(sf_rv_allpass3_st *allpass3, int offset){
-	if (offset > allpass3->size3)
-		return allpass3->buf3[allpass3->pos3];
-	else if (offset <= 0)
-		offset = 1;
-	int rp = allpass3->pos3 - offset;
-	if (rp < 0)
-		rp += allpass3->size3;
-	return allpass3->buf3[rp];
+	return allpass3->buf3[ring_at(allpass3->pos3, ring_age(offset, allpass3->size3),
+		allpass3->size3, allpass3->mask3)];
 }
 
 //
@@ -559,14 +639,14 @@ static inline void allpassm_make(sf_rv_allpassm_st *allpassm, int size, int msiz
 	if (msize > size)
 		msize = size;
 	int newsize = size + msize;
-	allpassm->rpos = (msize * 2) % newsize;
-	allpassm->wpos = 0;
+	allpassm->pos = 0;
+	allpassm->rdist = newsize - (msize * 2) % newsize;
 	allpassm->size = newsize;
 	allpassm->msize = msize;
+	allpassm->mask = ring_size(newsize) - 1;
 	allpassm->feedback = feedback;
 	allpassm->decay = decay;
 	allpassm->z1 = 0;
-	memset(allpassm->buf, 0, sizeof(float) * allpassm->size);
 }
 
 static inline float allpassm_step(sf_rv_allpassm_st *allpassm, float v, float mod, float fbmod){
@@ -574,17 +654,19 @@ static inline float allpassm_step(sf_rv_allpassm_st *allpassm, float v, float mo
 	mod = (mod + 1.0f) * (float)allpassm->msize;
 	float floormod = floorf(mod);
 	float mfrac = 1.0f - mod + floormod;
-	int rpos1 = allpassm->rpos - (int)floormod;
-	if (rpos1 < 0)
-		rpos1 += allpassm->size;
-	int rpos2 = rpos1 - 1;
-	if (rpos2 < 0)
-		rpos2 += allpassm->size;
-	allpassm->z1 = allpassm->buf[rpos2] + mfrac * (allpassm->buf[rpos1] - allpassm->z1);
-	allpassm->rpos = (allpassm->rpos + 1) % allpassm->size;
-	allpassm->buf[allpassm->wpos] = v + allpassm->z1 * mfeedback;
-	v = allpassm->decay * allpassm->z1 - allpassm->buf[allpassm->wpos] * mfeedback;
-	allpassm->wpos = (allpassm->wpos + 1) % allpassm->size;
+	int size = allpassm->size;
+	int age1 = allpassm->rdist + (int)floormod;
+	if (age1 > size)
+		age1 -= size;
+	int age2 = age1 + 1;
+	if (age2 > size)
+		age2 -= size;
+	allpassm->z1 = sf_denormal_flush(allpassm->buf[ring_at(allpassm->pos, age2, size,
+		allpassm->mask)] + mfrac * (allpassm->buf[ring_at(allpassm->pos, age1, size,
+		allpassm->mask)] - allpassm->z1));
+	allpassm->buf[allpassm->pos] = sf_denormal_flush(v + allpassm->z1 * mfeedback);
+	v = allpassm->decay * allpassm->z1 - allpassm->buf[allpassm->pos] * mfeedback;
+	allpassm->pos = ring_next(allpassm->pos, size, allpassm->mask);
 	return v;
 }
 
@@ -594,13 +676,14 @@ static inline float allpassm_step(sf_rv_allpassm_st *allpassm, float v, float mo
 static inline void comb_make(sf_rv_comb_st *comb, int size){
 	comb->pos = 0;
 	comb->size = clampi(size, 1, SF_REVERB_CS);
-	memset(comb->buf, 0, sizeof(float) * comb->size);
+	comb->mask = ring_size(comb->size) - 1;
 }
 
 static inline float comb_step(sf_rv_comb_st *comb, float v, float feedback){
-	v = comb->buf[comb->pos] * feedback + v;
+	v = sf_denormal_flush(comb->buf[ring_at(comb->pos, comb->size, comb->size, comb->mask)] *
+		feedback + v);
 	comb->buf[comb->pos] = v;
-	comb->pos = (comb->pos + 1) % comb->size;
+	comb->pos = ring_next(comb->pos, comb->size, comb->mask);
 	return v;
 }
 
@@ -612,7 +695,15 @@ static inline float comb_step(sf_rv_comb_st *comb, float v, float feedback){
 
 // now that all the components are done (thank god), we can start on the actual reverb effect
 
-void sf_presetreverb(sf_reverb_state_st *rv, int rate, sf_reverb_preset preset){
+typedef void (*advance_func)(sf_reverb_state_st *rv, int rate, int oversamplefactor,
+	float ertolate, float erefwet, float dry, float ereffactor, float erefwidth, float width,
+	float wet, float wander, float bassb, float spin, float inputlpf, float basslpf, float damplpf,
+	float outputlpf, float rt60, float delay);
+
+// look up the parameters of a preset, and pass them to `advance` (returns false for an unknown
+// preset)
+static bool presetreverb(sf_reverb_state_st *rv, int rate, sf_reverb_preset preset,
+	advance_func advance){
 	// sorry for the bad formatting, I've tried to cram this in as best as I could
 	struct {
 		int osf; float p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16;
@@ -642,9 +733,9 @@ void sf_presetreverb(sf_reverb_state_st *rv, int rate, sf_reverb_preset preset){
 	};
 
 	#define CASE(prs, i)                                                                        \
-		case prs: sf_advancereverb(rv, rate, ps[i].osf, ps[i].p1, ps[i].p2, ps[i].p3, ps[i].p4, \
+		case prs: advance(rv, rate, ps[i].osf, ps[i].p1, ps[i].p2, ps[i].p3, ps[i].p4,          \
 			ps[i].p5, ps[i].p6, ps[i].p7, ps[i].p8, ps[i].p9, ps[i].p10, ps[i].p11, ps[i].p12,  \
-			ps[i].p13, ps[i].p14, ps[i].p15, ps[i].p16); return;
+			ps[i].p13, ps[i].p14, ps[i].p15, ps[i].p16); return true;
 	switch (preset){
 		CASE(SF_REVERB_PRESET_DEFAULT    ,  0)
 		CASE(SF_REVERB_PRESET_SMALLHALL1 ,  1)
@@ -667,9 +758,11 @@ void sf_presetreverb(sf_reverb_state_st *rv, int rate, sf_reverb_preset preset){
 		CASE(SF_REVERB_PRESET_LONGREVERB2, 18)
 	}
 	#undef CASE
+	return false;
 }
 
-void sf_advancereverb(sf_reverb_state_st *rv, int rate,
+// make every component (without the buffers)
+static void reverb_setup(sf_reverb_state_st *rv, int rate,
 	int oversamplefactor, float ertolate, float erefwet, float dry, float ereffactor,
 	float erefwidth, float width, float wet, float wander, float bassb, float spin, float inputlpf,
 	float basslpf, float damplpf, float outputlpf, float rt60, float delay){
@@ -682,6 +775,8 @@ void sf_advancereverb(sf_reverb_state_st *rv, int rate,
 	rv->wet2 = wet * ((1.0f - width) * 0.5f);
 	rv->wander = wander;
 	rv->bassb = bassb;
+	rv->quiet = 0;
+	rv->decayed = false;
 
 	earlyref_make(&rv->earlyref, rate, ereffactor, erefwidth);
 
@@ -793,7 +888,278 @@ void sf_advancereverb(sf_reverb_state_st *rv, int rate,
 	}
 }
 
-void sf_reverb_process(sf_reverb_state_st *rv, int size, sf_sample_st *input, sf_sample_st *output){
+// place the ring buffers of the components one after the other in `rv->mem`, clear them, and
+// return the number of floats used; with `rv` NULL, only count them
+static int reverb_layout(sf_reverb_state_st *rv, const sf_reverb_state_st *sizes){
+	int total = 0;
+	#define LINE(buf, size)  do{                          \
+			int sz = (size);                              \
+			if (rv){                                      \
+				rv->buf = &rv->mem[total];                \
+				memset(rv->buf, 0, sizeof(float) * sz);   \
+			}                                             \
+			total += sz;                                  \
+		}while(0)
+	#define RING(buf, size)  LINE(buf, ring_size(size))
+	#define DELAY(d)  RING(d.buf, sizes->d.size)
+	DELAY(earlyref.delayPWL);
+	DELAY(earlyref.delayPWR);
+	DELAY(earlyref.delayRL);
+	DELAY(earlyref.delayLR);
+	LINE(noise.buf, SF_REVERB_NS);
+	for (int i = 0; i < 10; i++){
+		DELAY(diffL[i]);
+		DELAY(diffR[i]);
+	}
+	for (int i = 0; i < 4; i++){
+		DELAY(crossL[i]);
+		DELAY(crossR[i]);
+	}
+	DELAY(cdelayL);
+	DELAY(cdelayR);
+	DELAY(dampap1L);
+	DELAY(dampap1R);
+	DELAY(dampdL);
+	DELAY(dampdR);
+	DELAY(dampap2L);
+	DELAY(dampap2R);
+	DELAY(cbassd1L);
+	DELAY(cbassd1R);
+	RING(cbassap1L.buf1, sizes->cbassap1L.size1);
+	RING(cbassap1L.buf2, sizes->cbassap1L.size2);
+	RING(cbassap1R.buf1, sizes->cbassap1R.size1);
+	RING(cbassap1R.buf2, sizes->cbassap1R.size2);
+	DELAY(cbassd2L);
+	DELAY(cbassd2R);
+	RING(cbassap2L.buf1, sizes->cbassap2L.size1);
+	RING(cbassap2L.buf2, sizes->cbassap2L.size2);
+	RING(cbassap2L.buf3, sizes->cbassap2L.size3);
+	RING(cbassap2R.buf1, sizes->cbassap2R.size1);
+	RING(cbassap2R.buf2, sizes->cbassap2R.size2);
+	RING(cbassap2R.buf3, sizes->cbassap2R.size3);
+	DELAY(combL);
+	DELAY(combR);
+	DELAY(lastdelayL);
+	DELAY(lastdelayR);
+	DELAY(inpdelayL);
+	DELAY(inpdelayR);
+	#undef DELAY
+	#undef RING
+	#undef LINE
+	if (rv)
+		rv->memsize = total;
+	return total;
+}
+
+// allocate a state that fits the components made in `tmp`, and free `tmp`
+static sf_reverb_state_st *reverb_alloc(sf_reverb_state_st *tmp){
+	size_t hdrsize = offsetof(sf_reverb_state_st, mem);
+	int total = reverb_layout(NULL, tmp);
+	sf_reverb_state_st *rv =
+		(sf_reverb_state_st *)sf_aligned_malloc(hdrsize + sizeof(float) * total, SF_ALIGN);
+	if (rv){
+		memcpy(rv, tmp, hdrsize);
+		reverb_layout(rv, rv);
+#ifdef SF_REVERB_PROFILE
+		sf_reverb_resetstats(rv);
+#endif
+	}
+	sf_free(tmp);
+	return rv;
+}
+
+// a temporary state with room for the components, but not the buffers
+static inline sf_reverb_state_st *reverb_tmp(){
+	return (sf_reverb_state_st *)sf_malloc(offsetof(sf_reverb_state_st, mem));
+}
+
+sf_reverb_state_st *sf_reverb_new(int rate, sf_reverb_preset preset){
+	sf_reverb_state_st *tmp = reverb_tmp();
+	if (tmp == NULL)
+		return NULL;
+	if (!presetreverb(tmp, rate, preset, reverb_setup)){
+		sf_free(tmp);
+		return NULL;
+	}
+	return reverb_alloc(tmp);
+}
+
+sf_reverb_state_st *sf_reverb_newadvance(int rate, int oversamplefactor, float ertolate,
+	float erefwet, float dry, float ereffactor, float erefwidth, float width, float wet,
+	float wander, float bassb, float spin, float inputlpf, float basslpf, float damplpf,
+	float outputlpf, float rt60, float delay){
+	sf_reverb_state_st *tmp = reverb_tmp();
+	if (tmp == NULL)
+		return NULL;
+	reverb_setup(tmp, rate, oversamplefactor, ertolate, erefwet, dry, ereffactor, erefwidth,
+		width, wet, wander, bassb, spin, inputlpf, basslpf, damplpf, outputlpf, rt60, delay);
+	return reverb_alloc(tmp);
+}
+
+void sf_reverb_free(sf_reverb_state_st *rv){
+	sf_aligned_free(rv);
+}
+
+size_t sf_reverb_memsize(sf_reverb_state_st *rv){
+	return offsetof(sf_reverb_state_st, mem) + sizeof(float) * rv->memsize;
+}
+
+void sf_presetreverb(sf_reverb_state_st *rv, int rate, sf_reverb_preset preset){
+	presetreverb(rv, rate, preset, sf_advancereverb);
+}
+
+void sf_advancereverb(sf_reverb_state_st *rv, int rate,
+	int oversamplefactor, float ertolate, float erefwet, float dry, float ereffactor,
+	float erefwidth, float width, float wet, float wander, float bassb, float spin, float inputlpf,
+	float basslpf, float damplpf, float outputlpf, float rt60, float delay){
+	reverb_setup(rv, rate, oversamplefactor, ertolate, erefwet, dry, ereffactor, erefwidth, width,
+		wet, wander, bassb, spin, inputlpf, basslpf, damplpf, outputlpf, rt60, delay);
+	reverb_layout(rv, rv);
+#ifdef SF_REVERB_PROFILE
+	sf_reverb_resetstats(rv);
+#endif
+}
+
+#ifdef SF_REVERB_PROFILE
+void sf_reverb_getstats(sf_reverb_state_st *rv, sf_reverb_stats_st *stats){
+	*stats = rv->stats;
+}
+
+void sf_reverb_resetstats(sf_reverb_state_st *rv){
+	memset(&rv->stats, 0, sizeof(sf_reverb_stats_st));
+	rv->stats.cycles = PROF_CYCLES;
+}
+
+const char *sf_reverb_stagename(sf_reverb_stage stage){
+	switch (stage){
+		case SF_REVERB_STAGE_EARLYREF  : return "earlyref";
+		case SF_REVERB_STAGE_UPSAMPLE  : return "upsample";
+		case SF_REVERB_STAGE_DCCUT     : return "dccut";
+		case SF_REVERB_STAGE_MODULATION: return "modulation";
+		case SF_REVERB_STAGE_DIFFUSION : return "diffusion";
+		case SF_REVERB_STAGE_CROSSFADE : return "crossfade";
+		case SF_REVERB_STAGE_BASS      : return "bass";
+		case SF_REVERB_STAGE_DAMPENING : return "dampening";
+		case SF_REVERB_STAGE_CROSSBASS : return "crossbass";
+		case SF_REVERB_STAGE_OUTCO     : return "outco";
+		case SF_REVERB_STAGE_COMB      : return "comb";
+		case SF_REVERB_STAGE_LASTLPF   : return "lastlpf";
+		case SF_REVERB_STAGE_DOWNSAMPLE: return "downsample";
+		case SF_REVERB_STAGES          : break;
+	}
+	return "unknown";
+}
+#endif
+
+//
+// silence fast path
+//
+static inline bool quietf(float v){
+	return fabsf(v) <= SF_REVERB_SILENCE;
+}
+
+static inline bool iir1_quiet(const sf_rv_iir1_st *iir1){
+	return quietf(iir1->y1);
+}
+
+static inline bool biquad_quiet(const sf_rv_biquad_st *biquad){
+	return quietf(biquad->xn1) && quietf(biquad->xn2) && quietf(biquad->yn1) &&
+		quietf(biquad->yn2);
+}
+
+static inline bool dccut_quiet(const sf_rv_dccut_st *dccut){
+	return quietf(dccut->y1) && quietf(dccut->y2);
+}
+
+// whether everything that carries sound from one sample to the next is quiet (the noise and LFOs
+// carry the modulation instead, and keep running)
+static bool reverb_quiet(const sf_reverb_state_st *rv){
+	const sf_rv_earlyref_st *er = &rv->earlyref;
+	if (!biquad_quiet(&er->allpassXL) || !biquad_quiet(&er->allpassXR) ||
+		!biquad_quiet(&er->allpassL) || !biquad_quiet(&er->allpassR) ||
+		!iir1_quiet(&er->lpfL) || !iir1_quiet(&er->lpfR) ||
+		!iir1_quiet(&er->hpfL) || !iir1_quiet(&er->hpfR) ||
+		!biquad_quiet(&rv->oversampleL.lpfU) || !biquad_quiet(&rv->oversampleL.lpfD) ||
+		!biquad_quiet(&rv->oversampleR.lpfU) || !biquad_quiet(&rv->oversampleR.lpfD) ||
+		!dccut_quiet(&rv->dccutL) || !dccut_quiet(&rv->dccutR) ||
+		!iir1_quiet(&rv->clpfL) || !iir1_quiet(&rv->clpfR) ||
+		!biquad_quiet(&rv->bassapL) || !biquad_quiet(&rv->bassapR) ||
+		!biquad_quiet(&rv->basslpL) || !biquad_quiet(&rv->basslpR) ||
+		!iir1_quiet(&rv->damplpL) || !iir1_quiet(&rv->damplpR) ||
+		!quietf(rv->dampap1L.z1) || !quietf(rv->dampap1R.z1) ||
+		!quietf(rv->dampap2L.z1) || !quietf(rv->dampap2R.z1) ||
+		!biquad_quiet(&rv->lastlpfL) || !biquad_quiet(&rv->lastlpfR))
+		return false;
+	for (int i = 0; i < 10; i++){
+		if (!quietf(rv->diffL[i].z1) || !quietf(rv->diffR[i].z1))
+			return false;
+	}
+	// the delay lines, skipping the noise buffer
+	int noise = rv->noise.buf - rv->mem;
+	for (int i = 0; i < rv->memsize; i++){
+		if (i == noise)
+			i += SF_REVERB_NS - 1;
+		else if (!quietf(rv->mem[i]))
+			return false;
+	}
+	return true;
+}
+
+static inline void biquad_clear(sf_rv_biquad_st *biquad){
+	biquad->xn1 = biquad->xn2 = biquad->yn1 = biquad->yn2 = 0;
+}
+
+static inline void dccut_clear(sf_rv_dccut_st *dccut){
+	dccut->y1 = dccut->y2 = 0;
+}
+
+// clear what reverb_quiet checks
+static void reverb_clear(sf_reverb_state_st *rv){
+	sf_rv_earlyref_st *er = &rv->earlyref;
+	biquad_clear(&er->allpassXL);
+	biquad_clear(&er->allpassXR);
+	biquad_clear(&er->allpassL);
+	biquad_clear(&er->allpassR);
+	er->lpfL.y1 = er->lpfR.y1 = er->hpfL.y1 = er->hpfR.y1 = 0;
+	biquad_clear(&rv->oversampleL.lpfU);
+	biquad_clear(&rv->oversampleL.lpfD);
+	biquad_clear(&rv->oversampleR.lpfU);
+	biquad_clear(&rv->oversampleR.lpfD);
+	dccut_clear(&rv->dccutL);
+	dccut_clear(&rv->dccutR);
+	rv->clpfL.y1 = rv->clpfR.y1 = 0;
+	biquad_clear(&rv->bassapL);
+	biquad_clear(&rv->bassapR);
+	biquad_clear(&rv->basslpL);
+	biquad_clear(&rv->basslpR);
+	rv->damplpL.y1 = rv->damplpR.y1 = 0;
+	rv->dampap1L.z1 = rv->dampap1R.z1 = rv->dampap2L.z1 = rv->dampap2R.z1 = 0;
+	biquad_clear(&rv->lastlpfL);
+	biquad_clear(&rv->lastlpfR);
+	for (int i = 0; i < 10; i++)
+		rv->diffL[i].z1 = rv->diffR[i].z1 = 0;
+	int noise = rv->noise.buf - rv->mem;
+	memset(rv->mem, 0, sizeof(float) * noise);
+	memset(&rv->mem[noise + SF_REVERB_NS], 0,
+		sizeof(float) * (rv->memsize - noise - SF_REVERB_NS));
+}
+
+// with the state cleared, a silent input sample only changes the modulation, exactly like it would
+// in the full algorithm (everything else stays zero, and where the lines are in their rings doesn't
+// matter when they're empty)
+static inline void reverb_idle(sf_reverb_state_st *rv){
+	const float modnoise1 = 0.09f;
+	for (int i2 = 0; i2 < rv->oversampleL.factor; i2++){
+		float mnoise = noise_step(&rv->noise);
+		iir1_step(&rv->lfo1_lpf, (lfo_step(&rv->lfo1) + modnoise1 * mnoise) * rv->wander);
+		iir1_step(&rv->lfo2_lpf, lfo_step(&rv->lfo2) * rv->wander);
+	}
+}
+
+// the reverb core reads and writes the channels through pointers and a stride, so the same code
+// serves both the interleaved (stride 2) and planar (stride 1) entry points
+static inline void reverb_process(sf_reverb_state_st *rv, int64_t size, const float *inL,
+	const float *inR, float *outputL, float *outputR, int stride){
 	// extra hardcoded constants
 	const float modnoise1 = 0.09f;
 	const float modnoise2 = 0.06f;
@@ -802,33 +1168,57 @@ void sf_reverb_process(sf_reverb_state_st *rv, int size, sf_sample_st *input, sf
 	// oversample buffer
 	float osL[SF_REVERB_OF], osR[SF_REVERB_OF];
 
-	for (int i = 0; i < size; i++){
+	sf_denormal_st dn;
+	sf_denormal_enter(&dn);
+
+	PROF_START();
+	PROF_SAMPLES(size);
+	for (int64_t i = 0; i < size; i++){
 		// early reflection
-		sf_sample_st er = earlyref_step(&rv->earlyref, input[i]);
-		float erL = er.L * rv->ertolate + input[i].L;
-		float erR = er.R * rv->ertolate + input[i].R;
+		// (the input is only read here, so the output can overwrite it below)
+		sf_sample_st input = { inL[i * stride], inR[i * stride] };
+		bool silent = input.L == 0 && input.R == 0;
+		if (rv->decayed){
+			if (silent){
+				reverb_idle(rv);
+				outputL[i * stride] = 0;
+				outputR[i * stride] = 0;
+				// stepping the modulation is all the idle reverb does
+				PROF_MARK(SF_REVERB_STAGE_MODULATION);
+				continue;
+			}
+			rv->decayed = false;
+		}
+		sf_sample_st er = earlyref_step(&rv->earlyref, input);
+		float erL = er.L * rv->ertolate + input.L;
+		float erR = er.R * rv->ertolate + input.R;
+		PROF_MARK(SF_REVERB_STAGE_EARLYREF);
 
 		// oversample the single input into multiple outputs
 		oversample_stepup(&rv->oversampleL, erL, osL);
 		oversample_stepup(&rv->oversampleR, erR, osR);
+		PROF_MARK(SF_REVERB_STAGE_UPSAMPLE);
 
 		// for each oversampled sample...
 		for (int i2 = 0; i2 < rv->oversampleL.factor; i2++){
 			// dc cut
 			float outL = dccut_step(&rv->dccutL, osL[i2]);
 			float outR = dccut_step(&rv->dccutR, osR[i2]);
+			PROF_MARK(SF_REVERB_STAGE_DCCUT);
 
 			// noise
 			float mnoise = noise_step(&rv->noise);
 			float lfo = (lfo_step(&rv->lfo1) + modnoise1 * mnoise) * rv->wander;
 			lfo = iir1_step(&rv->lfo1_lpf, lfo);
 			mnoise *= modnoise2;
+			PROF_MARK(SF_REVERB_STAGE_MODULATION);
 
 			// diffusion
 			for (int i = 0, s = -1; i < 10; i++, s = -s){
 				outL = allpassm_step(&rv->diffL[i], outL, lfo * s, mnoise);
 				outR = allpassm_step(&rv->diffR[i], outR, lfo, mnoise * s);
 			}
+			PROF_MARK(SF_REVERB_STAGE_DIFFUSION);
 
 			// cross fade
 			float crossL = outL, crossR = outR;
@@ -838,6 +1228,7 @@ void sf_reverb_process(sf_reverb_state_st *rv, int size, sf_sample_st *input, sf
 			}
 			outL = iir1_step(&rv->clpfL, outL + crossfeed * crossR);
 			outR = iir1_step(&rv->clpfR, outR + crossfeed * crossL);
+			PROF_MARK(SF_REVERB_STAGE_CROSSFADE);
 
 			// bass boost
 			crossL = delay_getlast(&rv->cdelayL);
@@ -846,6 +1237,7 @@ void sf_reverb_process(sf_reverb_state_st *rv, int size, sf_sample_st *input, sf
 				(crossR + rv->bassb * biquad_step(&rv->basslpL, biquad_step(&rv->bassapL, crossR)));
 			outR += rv->loopdecay *
 				(crossL + rv->bassb * biquad_step(&rv->basslpR, biquad_step(&rv->bassapR, crossL)));
+			PROF_MARK(SF_REVERB_STAGE_BASS);
 
 			// dampening
 			outL = allpassm_step(&rv->dampap2L,
@@ -858,6 +1250,7 @@ void sf_reverb_process(sf_reverb_state_st *rv, int size, sf_sample_st *input, sf
 				allpassm_step(&rv->dampap1R,
 				iir1_step(&rv->damplpR, outR), -lfo, -mnoise)),
 				lfo, mnoise);
+			PROF_MARK(SF_REVERB_STAGE_DAMPENING);
 
 			// update cross fade bass boost delay
 			delay_step(&rv->cdelayL,
@@ -872,6 +1265,7 @@ void sf_reverb_process(sf_reverb_state_st *rv, int size, sf_sample_st *input, sf
 				allpass2_step(&rv->cbassap1R,
 				delay_step(&rv->cbassd1R, outR))),
 					-lfo));
+			PROF_MARK(SF_REVERB_STAGE_CROSSBASS);
 
 			//
 			float D1 =
@@ -918,10 +1312,12 @@ void sf_reverb_process(sf_reverb_state_st *rv, int size, sf_sample_st *input, sf
 
 			float D = D1 * 0.469f + D2 * 0.219f + D3 * 0.064f + D4 * 0.045f;
 			float B = B1 * 0.469f + B2 * 0.219f + B3 * 0.064f + B4 * 0.045f;
+			PROF_MARK(SF_REVERB_STAGE_OUTCO);
 
 			lfo = iir1_step(&rv->lfo2_lpf, lfo_step(&rv->lfo2) * rv->wander);
 			outL = comb_step(&rv->combL, D, lfo);
 			outR = comb_step(&rv->combR, B, -lfo);
+			PROF_MARK(SF_REVERB_STAGE_COMB);
 
 			outL = delay_step(&rv->lastdelayL, biquad_step(&rv->lastlpfL, outL));
 			outR = delay_step(&rv->lastdelayR, biquad_step(&rv->lastlpfR, outR));
@@ -930,12 +1326,40 @@ void sf_reverb_process(sf_reverb_state_st *rv, int size, sf_sample_st *input, sf
 				delay_step(&rv->inpdelayL, osL[i2]) * rv->dry;
 			osR[i2] = outR * rv->wet1 + outL * rv->wet2 +
 				delay_step(&rv->inpdelayR, osR[i2]) * rv->dry;
+			PROF_MARK(SF_REVERB_STAGE_LASTLPF);
 		}
 
 		float outL = oversample_stepdown(&rv->oversampleL, osL);
 		float outR = oversample_stepdown(&rv->oversampleR, osR);
-		outL += er.L * rv->erefwet + input[i].L * rv->dry;
-		outR += er.R * rv->erefwet + input[i].R * rv->dry;
-		output[i] = (sf_sample_st){ outL, outR };
+		outL += er.L * rv->erefwet + input.L * rv->dry;
+		outR += er.R * rv->erefwet + input.R * rv->dry;
+		outputL[i * stride] = outL;
+		outputR[i * stride] = outR;
+		PROF_MARK(SF_REVERB_STAGE_DOWNSAMPLE);
+
+		// look for the tail dying out
+		if (silent && quietf(outL) && quietf(outR)){
+			if (++rv->quiet >= SF_REVERB_QUIETLEN){
+				rv->quiet = 0;
+				if (reverb_quiet(rv)){
+					reverb_clear(rv);
+					rv->decayed = true;
+				}
+			}
+		}
+		else
+			rv->quiet = 0;
 	}
+
+	sf_denormal_leave(&dn);
+}
+
+void sf_reverb_process(sf_reverb_state_st *rv, int64_t size, sf_sample_st *input,
+	sf_sample_st *output){
+	reverb_process(rv, size, &input->L, &input->R, &output->L, &output->R, 2);
+}
+
+void sf_reverb_process_planar(sf_reverb_state_st *rv, int64_t size, const float *inputL,
+	const float *inputR, float *outputL, float *outputR){
+	reverb_process(rv, size, inputL, inputR, outputL, outputR, 1);
 }
@@ -12,17 +12,19 @@
 #define SNDFILTER_REVERB__H
 
 #include "snd.h"
+#include <stddef.h>
 
 // this API works by first initializing an sf_reverb_state_st structure, then using it to process a
 // sample in chunks
 //
 // for example, say you're processing a stream in 128 samples per chunk:
 //
-//   sf_reverb_state_st rv;
-//   sf_presetreverb(&rv, 44100, SF_REVERB_PRESET_DEFAULT);
+//   sf_reverb_state_st *rv = sf_reverb_new(44100, SF_REVERB_PRESET_DEFAULT);
 //
 //   for each 128 length sample:
-//     sf_reverb_process(&rv, 128, input, output);
+//     sf_reverb_process(rv, 128, input, output);
+//
+//   sf_reverb_free(rv);
 //
 // notice that sf_reverb_process will change a lot of the member variables inside of the state
 // structure, since these values must be carried over across chunk boundaries
@@ -30,6 +32,12 @@
 // also notice that the choice to divide the sound into chunks of 128 samples is completely
 // arbitrary from the reverb's perspective
 //
+// the output can be the same buffer as the input, to add the reverb in place (though the tail needs
+// room after the input, so it's usually generated separately by processing silence)
+//
+// once the input has been silent long enough for the tail to fade below SF_REVERB_SILENCE, the
+// state is cleared, and from then on silent input only steps the modulation (see below)
+//
 // ---
 //
 // non-convolution based reverb effects are made up from a lot of smaller effects
@@ -58,13 +66,40 @@
 // each component is designed to work one step at a time, so any size sample can be streamed through
 // in one pass
 
+// the buffers of the delay lines in these components point into the memory at the end of the state
+// structure (see sf_reverb_state_st below)
+//
+// each line is a ring buffer; its position is where the next value is written, and values are read
+// back by how many steps ago they were written (from 1 up to the size of the line)
+
+// with SF_REVERB_POW2 set to 1, the ring buffers are rounded up to a power of 2, so positions wrap
+// with a mask instead of a comparison; the sizes of the lines, and so the output, stay exactly the
+// same, but the buffers take up to twice the memory
+#ifndef SF_REVERB_POW2
+#	if defined(ARDUINO)
+#		define SF_REVERB_POW2  0
+#	else
+#		define SF_REVERB_POW2  1
+#	endif
+#endif
+
+// number of floats in the ring buffer of a line of size `n`
+#if SF_REVERB_POW2
+#	define SF_REVERB_P2_(n, s)  ((n) | ((n) >> (s)))
+#	define SF_REVERB_RING(n)    (SF_REVERB_P2_(SF_REVERB_P2_(SF_REVERB_P2_(SF_REVERB_P2_( \
+		SF_REVERB_P2_((n) - 1, 1), 2), 4), 8), 16) + 1)
+#else
+#	define SF_REVERB_RING(n)    (n)
+#endif
+
 // delay
 // delay buffer size; maximum size allowed for a delay
 #define SF_REVERB_DS        9814
 typedef struct {
-	int pos;                 // current write position
-	int size;                // delay size
-	float buf[SF_REVERB_DS]; // delay buffer
+	int pos;    // current write position
+	int size;   // delay size
+	int mask;   // ring buffer size - 1 (when SF_REVERB_POW2 is set)
+	float *buf; // delay buffer
 } sf_rv_delay_st;
 
 // 1st order IIR filter
@@ -122,8 +157,11 @@ typedef struct {
 // noise buffer size; must be a power of 2 because it's generated via fractal generator
 #define SF_REVERB_NS        (1<<15)
 typedef struct {
-	int pos;                 // current read position in the buffer
-	float buf[SF_REVERB_NS]; // buffer filled with noise
+	int pos;    // current read position in the buffer
+	float *buf; // buffer filled with noise
+	// random number generator state (per reverb, so reverbs don't change each other's noise)
+	uint32_t seed;
+	uint32_t count;
 } sf_rv_noise_st;
 
 // low-frequency oscilator (LFO)
@@ -141,9 +179,10 @@ typedef struct {
 typedef struct {
 	int pos;
 	int size;
+	int mask;
 	float feedback;
 	float decay;
-	float buf[SF_REVERB_APS];
+	float *buf;
 } sf_rv_allpass_st;
 
 // 2nd order all-pass filter
@@ -151,12 +190,13 @@ typedef struct {
 #define SF_REVERB_AP2S1     11437
 #define SF_REVERB_AP2S2     3449
 typedef struct {
-	//    line 1                 line 2
-	int   pos1                 , pos2                 ;
-	int   size1                , size2                ;
-	float feedback1            , feedback2            ;
-	float decay1               , decay2               ;
-	float buf1[SF_REVERB_AP2S1], buf2[SF_REVERB_AP2S2];
+	//     line 1     line 2
+	int    pos1     , pos2     ;
+	int    size1    , size2    ;
+	int    mask1    , mask2    ;
+	float  feedback1, feedback2;
+	float  decay1   , decay2   ;
+	float *buf1     ,*buf2     ;
 } sf_rv_allpass2_st;
 
 // 3rd order all-pass filter with modulation
@@ -166,12 +206,14 @@ typedef struct {
 #define SF_REVERB_AP3S2     4597
 #define SF_REVERB_AP3S3     7541
 typedef struct {
-	//    line 1 (with modulation)                 line 2                 line 3
-	int   rpos1, wpos1                           , pos2                 , pos3                 ;
-	int   size1, msize1                          , size2                , size3                ;
-	float feedback1                              , feedback2            , feedback3            ;
-	float decay1                                 , decay2               , decay3               ;
-	float buf1[SF_REVERB_AP3S1 + SF_REVERB_AP3M1], buf2[SF_REVERB_AP3S2], buf3[SF_REVERB_AP3S3];
+	// line 1 is read `rdist1` steps behind its position, minus the modulation
+	//     line 1 (with modulation)  line 2     line 3
+	int    pos1, rdist1            , pos2     , pos3     ;
+	int    size1, msize1           , size2    , size3    ;
+	int    mask1                   , mask2    , mask3    ;
+	float  feedback1               , feedback2, feedback3;
+	float  decay1                  , decay2   , decay3   ;
+	float *buf1                    ,*buf2     ,*buf3     ;
 } sf_rv_allpass3_st;
 
 // modulated all-pass filter
@@ -179,12 +221,13 @@ typedef struct {
 #define SF_REVERB_APMS      8681
 #define SF_REVERB_APMM      137
 typedef struct {
-	int rpos, wpos;
+	int pos, rdist; // the line is read `rdist` steps behind its position, minus the modulation
 	int size, msize;
+	int mask;
 	float feedback;
 	float decay;
 	float z1;
-	float buf[SF_REVERB_APMS + SF_REVERB_APMM];
+	float *buf;
 } sf_rv_allpassm_st;
 
 // comb filter
@@ -193,13 +236,73 @@ typedef struct {
 typedef struct {
 	int pos;
 	int size;
-	float buf[SF_REVERB_CS];
+	int mask;
+	float *buf;
 } sf_rv_comb_st;
 
+// silence fast path
+// after the input has been silent and the output no louder than SF_REVERB_SILENCE for
+// SF_REVERB_QUIETLEN samples in a row, the state is checked, and if all of it is that quiet too,
+// it's cleared to exactly zero; from then on, silent input samples skip the whole algorithm, except
+// for stepping the noise and LFOs, until the input makes a sound again
+//
+// SF_REVERB_SILENCE is about -180dB, which is far below what a 24-bit file can hold; set it to 0 to
+// only take the fast path once the tail has decayed to exactly zero
+#ifndef SF_REVERB_SILENCE
+#	define SF_REVERB_SILENCE   1e-9f
+#endif
+#ifndef SF_REVERB_QUIETLEN
+#	define SF_REVERB_QUIETLEN  8192
+#endif
+
+// per-stage profiling
+// compile the library with SF_REVERB_PROFILE defined to have sf_reverb_process accumulate the time
+// spent in each stage of the algorithm; without it, none of this code exists in the process loop
+typedef enum {
+	SF_REVERB_STAGE_EARLYREF,   // early reflection
+	SF_REVERB_STAGE_UPSAMPLE,   // oversampling of the input
+	SF_REVERB_STAGE_DCCUT,      // dc cut
+	SF_REVERB_STAGE_MODULATION, // fractal noise and LFO
+	SF_REVERB_STAGE_DIFFUSION,  // 10-stage diffusion all-passes
+	SF_REVERB_STAGE_CROSSFADE,  // cross fade all-passes and cross LPF
+	SF_REVERB_STAGE_BASS,       // bass boost
+	SF_REVERB_STAGE_DAMPENING,  // dampening lowpass, all-passes and delay
+	SF_REVERB_STAGE_CROSSBASS,  // cross fade bass delays and all-passes
+	SF_REVERB_STAGE_OUTCO,      // 32-tap output matrix
+	SF_REVERB_STAGE_COMB,       // comb filter and second LFO
+	SF_REVERB_STAGE_LASTLPF,    // last lowpass, last delay and wet/dry mix
+	SF_REVERB_STAGE_DOWNSAMPLE, // downsampling and final mix
+	SF_REVERB_STAGES
+} sf_reverb_stage;
+
+typedef struct {
+	unsigned long long ticks[SF_REVERB_STAGES]; // accumulated time per stage
+	unsigned long long samples;                 // number of input samples processed
+	bool cycles; // true if ticks are CPU cycles, false if they are nanoseconds
+} sf_reverb_stats_st;
+
+// memory needed for the delay lines at their maximum sizes (about 2 megs, or 3.5 megs with
+// SF_REVERB_POW2)
+#define SF_REVERB_MEMSIZE  (                                                      \
+	SF_REVERB_RING(SF_REVERB_DS) * 16 +                                           \
+	SF_REVERB_RING(SF_REVERB_APMS + SF_REVERB_APMM) * 24 +                        \
+	SF_REVERB_RING(SF_REVERB_APS) * 8 +                                           \
+	(SF_REVERB_RING(SF_REVERB_AP2S1) + SF_REVERB_RING(SF_REVERB_AP2S2)) * 2 +     \
+	(SF_REVERB_RING(SF_REVERB_AP3S1 + SF_REVERB_AP3M1) +                          \
+		SF_REVERB_RING(SF_REVERB_AP3S2) + SF_REVERB_RING(SF_REVERB_AP3S3)) * 2 +  \
+	SF_REVERB_RING(SF_REVERB_CS) * 2 +                                            \
+	SF_REVERB_NS)
+
 //
 // the final reverb state structure
 //
-// note: this is about 2megs, so you might not want to throw these around willy-nilly
+// the delay lines are laid out one after the other in `mem`, at the sizes picked by the parameters
+//
+// a full structure has room for every line at its maximum size, which is 2-3.5megs, so you might
+// not want to throw these around willy-nilly; sf_reverb_new allocates just the part of `mem` that
+// the parameters need instead, which is usually several times smaller
+//
+// the components point into `mem`, so a populated state can't be copied with = or memcpy
 typedef struct {
 	sf_rv_earlyref_st   earlyref;
 	sf_rv_oversample_st oversampleL, oversampleR;
@@ -235,6 +338,13 @@ typedef struct {
 	float ertolate; // early reflection mix parameters
 	float erefwet;
 	float dry;
+	int quiet;    // samples in a row with silent input and quiet output, up to SF_REVERB_QUIETLEN
+	bool decayed; // the state is cleared, and the input has been silent since
+#ifdef SF_REVERB_PROFILE
+	sf_reverb_stats_st stats;
+#endif
+	int memsize; // number of floats in `mem` used by the delay lines
+	float mem[SF_REVERB_MEMSIZE]; // delay lines (must be last)
 } sf_reverb_state_st;
 
 typedef enum {
@@ -259,10 +369,28 @@ typedef enum {
 	SF_REVERB_PRESET_LONGREVERB2
 } sf_reverb_preset;
 
-// populate a reverb state with a preset
+// allocate a reverb state with only as much memory as the preset needs at the sample rate, and
+// populate it (returns NULL for error)
+// the state can't be passed to sf_presetreverb or sf_advancereverb afterwards, since those need a
+// full structure; create a new one instead
+sf_reverb_state_st *sf_reverb_new(int rate, sf_reverb_preset preset);
+
+// same as above, with advanced parameters (see sf_advancereverb)
+sf_reverb_state_st *sf_reverb_newadvance(int rate, int oversamplefactor, float ertolate,
+	float erefwet, float dry, float ereffactor, float erefwidth, float width, float wet,
+	float wander, float bassb, float spin, float inputlpf, float basslpf, float damplpf,
+	float outputlpf, float rt60, float delay);
+
+// free a state from sf_reverb_new or sf_reverb_newadvance
+void sf_reverb_free(sf_reverb_state_st *state);
+
+// bytes of memory used by a populated state (the size of the allocation, for sf_reverb_new)
+size_t sf_reverb_memsize(sf_reverb_state_st *state);
+
+// populate a full reverb state with a preset
 void sf_presetreverb(sf_reverb_state_st *state, int rate, sf_reverb_preset preset);
 
-// populate a reverb state with advanced parameters
+// populate a full reverb state with advanced parameters
 void sf_advancereverb(sf_reverb_state_st *rv,
 	int rate,             // input sample rate (samples per second)
 	int oversamplefactor, // how much to oversample [1 to 4]
@@ -285,8 +413,25 @@ void sf_advancereverb(sf_reverb_state_st *rv,
 );
 
 // this function will process the input sound based on the state passed
-// the input and output buffers should be the same size
-void sf_reverb_process(sf_reverb_state_st *state, int size, sf_sample_st *input,
+// the input and output buffers should be the same size, and can be the same buffer (but shouldn't
+// otherwise overlap)
+void sf_reverb_process(sf_reverb_state_st *state, int64_t size, sf_sample_st *input,
 	sf_sample_st *output);
 
+// same as above, but with each channel in its own buffer (see sf_psnd in snd.h)
+void sf_reverb_process_planar(sf_reverb_state_st *state, int64_t size, const float *inputL,
+	const float *inputR, float *outputL, float *outputR);
+
+#ifdef SF_REVERB_PROFILE
+// copy the accumulated per-stage statistics out of the state (they are reset by sf_advancereverb
+// and sf_presetreverb)
+void sf_reverb_getstats(sf_reverb_state_st *state, sf_reverb_stats_st *stats);
+
+// clear the accumulated per-stage statistics
+void sf_reverb_resetstats(sf_reverb_state_st *state);
+
+// human readable name of a stage, for printing the statistics
+const char *sf_reverb_stagename(sf_reverb_stage stage);
+#endif
+
 #endif // SNDFILTER_REVERB__H
@@ -7,25 +7,74 @@
 
 #include "snd.h"
 #include "mem.h"
+#include <stdint.h>
 #include <string.h>
 
-sf_snd sf_snd_new(int size, int rate, bool clear){
+sf_snd sf_snd_new(int64_t size, int rate, bool clear){
+	// make sure the buffer size fits in a size_t (which is only 32 bits on some platforms)
+	if (size < 0 || (uint64_t)size > SIZE_MAX / sizeof(sf_sample_st))
+		return NULL;
+	size_t bytes = sf_alignsize(sizeof(sf_sample_st) * size);
+	if (bytes == 0 && size > 0)
+		return NULL;
 	sf_snd snd = (sf_snd_st *)sf_malloc(sizeof(sf_snd_st));
 	if (snd == NULL)
 		return NULL;
 	snd->size = size;
 	snd->rate = rate;
-	snd->samples = (sf_sample_st *) sf_malloc(sizeof(sf_sample_st) * size);
+	snd->samples = (sf_sample_st *)sf_aligned_malloc(bytes, SF_ALIGN);
 	if (snd->samples == NULL){
 		sf_free(snd);
 		return NULL;
 	}
-	if (clear && size > 0)
-		memset(snd->samples, 0, sizeof(sf_sample_st) * size);
+	if (clear && bytes > 0)
+		memset(snd->samples, 0, bytes);
 	return snd;
 }
 
 void sf_snd_free(sf_snd snd){
-	sf_free(snd->samples);
+	sf_aligned_free(snd->samples);
 	sf_free(snd);
 }
+
+sf_psnd sf_psnd_new(int64_t size, int rate, bool clear){
+	// pad each channel to the alignment, so R starts aligned too
+	if (size < 0 || (uint64_t)size > SIZE_MAX / (2 * sizeof(float)))
+		return NULL;
+	size_t chbytes = sf_alignsize(sizeof(float) * size);
+	if (chbytes > SIZE_MAX / 2 || (chbytes == 0 && size > 0))
+		return NULL;
+	sf_psnd snd = (sf_psnd_st *)sf_malloc(sizeof(sf_psnd_st));
+	if (snd == NULL)
+		return NULL;
+	snd->size = size;
+	snd->rate = rate;
+	snd->L = (float *)sf_aligned_malloc(chbytes * 2, SF_ALIGN);
+	if (snd->L == NULL){
+		sf_free(snd);
+		return NULL;
+	}
+	snd->R = snd->L + chbytes / sizeof(float);
+	if (clear && chbytes > 0)
+		memset(snd->L, 0, chbytes * 2);
+	return snd;
+}
+
+void sf_psnd_free(sf_psnd snd){
+	sf_aligned_free(snd->L);
+	sf_free(snd);
+}
+
+void sf_deinterleave(int64_t size, const sf_sample_st *input, float *outputL, float *outputR){
+	for (int64_t i = 0; i < size; i++){
+		outputL[i] = input[i].L;
+		outputR[i] = input[i].R;
+	}
+}
+
+void sf_interleave(int64_t size, const float *inputL, const float *inputR, sf_sample_st *output){
+	for (int64_t i = 0; i < size; i++){
+		output[i].L = inputL[i];
+		output[i].R = inputR[i];
+	}
+}
@@ -5,25 +5,51 @@
 // SPDX-License-Identifier: 0BSD
 //
 
-// data structure for a 2-channel 32-bit floating point sound in memory
+// data structures for a 2-channel 32-bit floating point sound in memory, either interleaved
+// (sf_snd) or planar (sf_psnd)
 
 #ifndef SNDFILTER_SND__H
 #define SNDFILTER_SND__H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct {
 	float L; // left channel sample
 	float R; // right channel sample
 } sf_sample_st;
 
+// the samples of both kinds of sound are aligned to SF_ALIGN bytes, and padded to a multiple of it
+// (see mem.h)
 typedef struct {
 	sf_sample_st *samples;
-	int size; // number of samples
+	int64_t size; // number of samples
 	int rate; // samples per second
 } sf_snd_st, *sf_snd;
 
-sf_snd sf_snd_new(int size, int rate, bool clear);
+sf_snd sf_snd_new(int64_t size, int rate, bool clear);
 void   sf_snd_free(sf_snd snd);
 
+// planar (structure of arrays) sound, with each channel in its own contiguous buffer
+//
+// the filters have *_planar variants that work on these directly, which lets per-channel work run
+// over plain float arrays instead of picking every other value out of sf_sample_st pairs
+//
+// both channels share one allocation, starting at L
+typedef struct {
+	float *L; // left channel samples
+	float *R; // right channel samples
+	int64_t size; // number of samples
+	int rate; // samples per second
+} sf_psnd_st, *sf_psnd;
+
+sf_psnd sf_psnd_new(int64_t size, int rate, bool clear);
+void    sf_psnd_free(sf_psnd snd);
+
+// convert between the layouts
+// these are simple loops that the compiler vectorizes, and work on any range, so long chains can
+// convert one cache-sized block at a time instead of copying the whole sound
+void sf_deinterleave(int64_t size, const sf_sample_st *input, float *outputL, float *outputR);
+void sf_interleave(int64_t size, const float *inputL, const float *inputR, sf_sample_st *output);
+
 #endif // SNDFILTER_SND__H
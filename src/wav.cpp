@@ -6,251 +6,761 @@
 //
 
 #include "wav.h"
+#include "mem.h"
+#include "convert.h"
 #include <stdio.h>
 #include <stdint.h>
-#include <SPI.h>
-#include <SD.h>
+#include <string.h>
+#if defined(ARDUINO)
+#include <Arduino.h>
+#endif
+
+// pick the default I/O backend for the platform
+#if defined(ARDUINO)
+const sf_wavio_st *sf_wavio = &sf_wavio_sd;
+#else
+const sf_wavio_st *sf_wavio = &sf_wavio_posix;
+#endif
+
+// most samples converted in one go, which keeps the value counts of the conversions within an int
+#define CONVERT_MAXRUN  (1 << 28)
+
+// samples moved through the stack at a time by the planar read and write functions (8 bytes each)
+#define PLANAR_BLOCK  256
+
+// streaming reader state
+struct sf_wavreader_st {
+	const sf_wavio_st *io;
+	void *fh;
+	int rate;        // samples per second
+	int64_t size;    // total number of samples in the data chunk
+	int64_t left;    // samples left to read
+	int numchannels; // channels in the file (1 or 2)
+	int framesize;   // bytes per sample frame in the file
+	sf_wav_format format;
+	uint64_t have;   // bytes in buf that haven't been converted yet
+	uint64_t bufpos; // offset in buf of the first byte that hasn't been converted
+	uint64_t pos;    // current position in the file
+	uint8_t *buf;    // block buffer, or the start of the data chunk when mapped
+	void *map;       // file mapping (NULL if the data is read in blocks)
+	uint64_t mapsize;
+};
+
+// streaming writer state
+struct sf_wavwriter_st {
+	const sf_wavio_st *io;
+	void *fh;
+	int rate;        // samples per second
+	uint64_t size;   // samples written so far
+	uint64_t hint;   // samples expected when the writer was opened
+	uint64_t len;    // bytes staged in buf
+	uint64_t cap;    // size of buf
+	uint32_t hdrsize; // bytes before the sample data
+	bool ds64;       // the header has room for a ds64 chunk, so it can become RF64
+	int framesize;   // bytes per sample frame in the file
+	sf_wav_format format;
+	bool ok;         // false after any write fails
+	bool dither;     // apply TPDF dither when converting to int16
+	sf_dither_st ds;
+	uint8_t *buf;    // block buffer, or the whole file when mapped
+	void *map;       // file mapping (NULL if the data is written in blocks)
+};
 
 // read an unsigned 32-bit integer in little endian format
-static inline uint32_t read_u32le(File fp){
-	uint32_t b1 = fp.read();
-	uint32_t b2 = fp.read();
-	uint32_t b3 = fp.read();
-	uint32_t b4 = fp.read();
-	return b1 | (b2 << 8) | (b3 << 16) | (b4 << 24);
+static inline uint32_t read_u32le(const sf_wavio_st *io, void *fh){
+	uint8_t b[4] = { 0, 0, 0, 0 };
+	io->read(fh, b, 4);
+	return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+// read an unsigned 64-bit integer in little endian format
+static inline uint64_t read_u64le(const sf_wavio_st *io, void *fh){
+	uint64_t lo = read_u32le(io, fh);
+	return lo | ((uint64_t)read_u32le(io, fh) << 32);
 }
 
 // read an unsigned 16-bit integer in little endian format
-static inline uint16_t read_u16le(File fp){
-	uint16_t b1 = fp.read();
-	uint16_t b2 = fp.read();
-	return b1 | (b2 << 8);
+static inline uint16_t read_u16le(const sf_wavio_st *io, void *fh){
+	uint8_t b[2] = { 0, 0 };
+	io->read(fh, b, 2);
+	return b[0] | (b[1] << 8);
 }
 
-// write an unsigned 32-bit integer in little endian format
-static inline void write_u32le(File fp, uint32_t v){
-	fp.write(v & 0xFF);
-	fp.write((v >> 8) & 0xFF);
-	fp.write((v >> 16) & 0xFF);
-	fp.write((v >> 24) & 0xFF);
-}	
+// store an unsigned 32-bit integer in little endian format
+static inline void put_u32le(uint8_t *p, uint32_t v){
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+	p[2] = (v >> 16) & 0xFF;
+	p[3] = (v >> 24) & 0xFF;
+}
+
+// store an unsigned 64-bit integer in little endian format
+static inline void put_u64le(uint8_t *p, uint64_t v){
+	put_u32le(p, (uint32_t)v);
+	put_u32le(p + 4, (uint32_t)(v >> 32));
+}
+
+// store an unsigned 16-bit integer in little endian format
+static inline void put_u16le(uint8_t *p, uint16_t v){
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+}
+
+// skip ahead in the file
+static inline bool skip(const sf_wavio_st *io, void *fh, uint32_t size){
+	return io->seek(fh, io->tell(fh) + size);
+}
 
-// write an unsigned 16-bit integer in little endian format
-static inline void write_u16le(File fp, uint16_t v){
-	fp.write(v & 0xFF);
-	fp.write((v >> 8) & 0xFF);
+// refill the reader's block buffer
+//
+// the data is pulled in with large block reads (SF_WAV_BLOCKSIZE) instead of byte-by-byte, and each
+// read ends on a block boundary of the file so the storage driver can service it directly
+static bool reader_fill(sf_wavreader_st *rd){
+	if (rd->map)
+		return false; // the mapping holds all of the data, so this is the end
+
+	// move the partial frame (if any) to the front of the buffer
+	if (rd->have > 0 && rd->bufpos > 0)
+		memmove(rd->buf, rd->buf + rd->bufpos, rd->have);
+	rd->bufpos = 0;
+
+	// read up to the next block boundary, but not past the end of the data
+	uint32_t want = SF_WAV_BLOCKSIZE - (rd->pos % SF_WAV_BLOCKSIZE);
+	uint64_t left = (uint64_t)rd->left * rd->framesize - rd->have;
+	if (want > left)
+		want = (uint32_t)left;
+	int got = rd->io->read(rd->fh, rd->buf + rd->have, want);
+	if (got <= 0)
+		return false; // file is truncated
+	rd->pos += got;
+	rd->have += got;
+	return true;
 }
 
+#if defined(ARDUINO)
 #define LINE Serial.printf("%s:%d \n", __FUNCTION__, __LINE__)
 #define VLINE(val) Serial.printf("%s:%d "#val"= 0x%X (%d) \n", __FUNCTION__, __LINE__, val, val)
 #define V2LINE(val,cal) Serial.printf("%s:%d "#val"= 0x%X (%d) expect 0x%X (%d) \n",\
 	__FUNCTION__, __LINE__,\
 	val, val,\
 	cal, cal)
-
-// load a WAV file (returns NULL for error)
-sf_snd sf_wavload(const char *file){
-
-	
-	File fp;
-
-	fp = SD.open(file);
-	//FILE *fp = fopen(file, "rb");
+#else
+#define LINE
+#define VLINE(val)
+#define V2LINE(val,cal)
+#endif
+
+sf_wavreader_st *sf_wavreader_open(const char *file){
+	const sf_wavio_st *io = sf_wavio;
+	void *fp = io->open(file, false);
 	LINE;
-	
-	if (!fp)
+
+	if (fp == NULL)
 	{
-		Serial.printf("cannot open for reading %s\n", file);
+		LINE;
 		return NULL;
 	}
 
 	LINE;
-	uint32_t riff = read_u32le(fp);
-	if (riff != 0x46464952){ // 'RIFF'
+	// RF64 (and BW64, its EBU twin) is RIFF with the 32-bit sizes set to 0xFFFFFFFF, and the real
+	// 64-bit sizes stored in a ds64 chunk at the front of the file
+	uint32_t riff = read_u32le(io, fp);
+	bool rf64 = riff == 0x34364652 || riff == 0x34365742; // 'RF64', 'BW64'
+	if (riff != 0x46464952 && !rf64){ // 'RIFF'
 		V2LINE(riff, 0x46464952);
-		fp.close();
+		io->close(fp);
 		return NULL;
 	}
 
 	V2LINE(riff, 0x46464952);
-	read_u32le(fp); // filesize; don't really care about this
+	read_u32le(io, fp); // filesize; don't really care about this
 
-	uint32_t wave = read_u32le(fp);
+	uint32_t wave = read_u32le(io, fp);
 	V2LINE(wave, 0x45564157);
-	
+
 	if (wave != 0x45564157)
 	{ // 'WAVE'
 		LINE;
-		fp.close();
+		io->close(fp);
 		return NULL;
 	}
 	LINE;
-	
+
 	// start reading chunks
 	bool found_fmt = false;
-	uint16_t audioformat;
-	uint16_t numchannels;
-	uint32_t samplerate;
-	uint16_t bps;
-
-	while (fp.available())
+	uint16_t audioformat = 0;
+	uint16_t numchannels = 0;
+	uint32_t samplerate = 0;
+	uint16_t bps = 0;
+	sf_wav_format format = SF_WAV_PCM16;
+	uint64_t datasize64 = 0;
+	uint64_t filesize = io->size(fp);
+
+	while (io->tell(fp) + 8 <= filesize)
 	{
-		uint32_t chunkid = read_u32le(fp);
-		uint32_t chunksize = read_u32le(fp);
-		
+		uint32_t chunkid = read_u32le(io, fp);
+		uint32_t chunksize = read_u32le(io, fp);
+
 		V2LINE(chunkid, 0x20746D66);
 		VLINE(chunksize);
-		
-		if (chunkid == 0x20746D66)
+
+		if (chunkid == 0x34367364){ // 'ds64'
+			if (chunksize < 24){
+				io->close(fp);
+				return NULL;
+			}
+			read_u64le(io, fp); // RIFF size, ignored like the 32-bit one
+			datasize64 = read_u64le(io, fp);
+			skip(io, fp, chunksize - 16); // sample count and chunk size table, ignored
+		}
+
+		else if (chunkid == 0x20746D66)
 		{ // 'fmt '
 			// confirm we haven't already processed the fmt chunk, and that it's a good size
 			if (found_fmt || chunksize < 16)
 			{
 				LINE;
-				fp.close();
+				io->close(fp);
 				return NULL;
 			}
 
 			found_fmt = true;
 
 			// load the fmt information
-			audioformat = read_u16le(fp);
+			audioformat = read_u16le(io, fp);
 			VLINE(audioformat);
-			
-			numchannels = read_u16le(fp);
+
+			numchannels = read_u16le(io, fp);
 			VLINE(numchannels);
-			
-			samplerate  = read_u32le(fp);
+
+			samplerate  = read_u32le(io, fp);
 			VLINE(samplerate);
 
-			read_u32le(fp); // byte rate, ignored
-			read_u16le(fp); // block align, ignored
-			bps         = read_u16le(fp);
+			read_u32le(io, fp); // byte rate, ignored
+			read_u16le(io, fp); // block align, ignored
+			bps         = read_u16le(io, fp);
 
 			VLINE(bps);
-			// only support 1/2-channel 16-bit samples
-			if (audioformat != 1 || bps != 16 || (numchannels != 1 && numchannels != 2)){
-				fp.close();
+			uint32_t fmtread = 16;
+
+			// WAVE_FORMAT_EXTENSIBLE stores the real format code at the start of the sub-format
+			// GUID, after the extension size, valid bits, and channel mask
+			if (audioformat == 0xFFFE){
+				if (chunksize < 40){
+					io->close(fp);
+					return NULL;
+				}
+				skip(io, fp, 8);
+				audioformat = read_u16le(io, fp);
+				fmtread = 26;
+				VLINE(audioformat);
+			}
+
+			// only support 1/2-channel 16-bit PCM, 24-bit PCM, or 32-bit float samples
+			if (audioformat == 1 && bps == 16)
+				format = SF_WAV_PCM16;
+			else if (audioformat == 1 && bps == 24)
+				format = SF_WAV_PCM24;
+			else if (audioformat == 3 && bps == 32)
+				format = SF_WAV_FLOAT32;
+			else{
+				io->close(fp);
+				return NULL;
+			}
+			if (numchannels != 1 && numchannels != 2){
+				io->close(fp);
 				return NULL;
 			}
 
 			// skip ahead of the rest of the fmt chunk
-			if (chunksize > 16)
-				fp.seek(chunksize - 16, SeekMode::SeekCur);
+			if (chunksize > fmtread)
+				skip(io, fp, chunksize - fmtread);
 		}
-		
+
 		else if (chunkid == 0x61746164)
 			{ // 'data'
 
+			// in RF64 files, the real size of the data chunk comes from the ds64 chunk
+			uint64_t datasize = chunksize;
+			if (rf64 && chunksize == 0xFFFFFFFF)
+				datasize = datasize64;
+
 			// confirm we've already processed the fmt chunk
 			// confirm chunk size is evenly divisible by bytes per sample
-			if (!found_fmt || (chunksize % (numchannels * bps / 8)) != 0){
-				fp.close();
+			if (!found_fmt || (datasize % (numchannels * bps / 8)) != 0){
+				io->close(fp);
 				V2LINE(chunkid, 0x61746164);
 				return NULL;
 			}
 
-			// calculate the number of samples based on the chunk size and allocate the space
-			int scount = chunksize / (numchannels * bps / 8);
-			sf_snd sndBufferFloat = sf_snd_new(scount, samplerate, false);
+			// calculate the number of samples based on the chunk size
+			int64_t scount = datasize / (numchannels * bps / 8);
 
-			if (sndBufferFloat == NULL){
-				fp.close();
-				VLINE(sndBufferFloat);
+			sf_wavreader_st *rd = (sf_wavreader_st *)sf_malloc(sizeof(sf_wavreader_st));
+			if (rd == NULL){
+				io->close(fp);
+				LINE;
 				return NULL;
 			}
-
-			// read the data and convert to stereo floating point
-			int16_t L, R;
-
-			for (int i = 0; i < scount; i++){
-				// read the sample
-				L = (int16_t)read_u16le(fp);
-				if (numchannels == 1)
-					R = L; // expand to stereo
-				else
-					R = (int16_t)read_u16le(fp);
-
-				// convert the sample to floating point
-				// notice that int16 samples range from -32768 to 32767, therefore we have a
-				// different divisor depending on whether the value is negative or not
-				if (L < 0)
-					sndBufferFloat->samples[i].L = (float)L / 32768.0f;
-				else
-					sndBufferFloat->samples[i].L = (float)L / 32767.0f;
-				if (R < 0)
-					sndBufferFloat->samples[i].R = (float)R / 32768.0f;
-				else
-					sndBufferFloat->samples[i].R = (float)R / 32767.0f;
+			rd->io          = io;
+			rd->fh          = fp;
+			rd->rate        = samplerate;
+			rd->size        = scount;
+			rd->left        = scount;
+			rd->numchannels = numchannels;
+			rd->framesize   = numchannels * bps / 8;
+			rd->format      = format;
+			rd->have        = 0;
+			rd->bufpos      = 0;
+			rd->pos         = io->tell(fp);
+			rd->buf         = NULL;
+			rd->map         = NULL;
+			rd->mapsize     = 0;
+
+			// if the backend can map the file, then decode straight out of the mapping, otherwise
+			// fall back to reading blocks
+			//
+			// a truncated file isn't mapped, so that reads past the end fail gracefully
+			uint64_t dataend = rd->pos + datasize;
+			if (io->map && dataend <= filesize){
+				rd->map = io->map(fp, dataend, false);
+				if (rd->map){
+					rd->mapsize = dataend;
+					rd->buf = (uint8_t *)rd->map + rd->pos;
+					rd->have = datasize;
+				}
+			}
+			if (rd->map == NULL){
+				rd->buf = (uint8_t *)sf_aligned_malloc(
+					sf_alignsize(SF_WAV_BLOCKSIZE + rd->framesize), SF_ALIGN);
+				if (rd->buf == NULL){
+					sf_free(rd);
+					io->close(fp);
+					LINE;
+					return NULL;
+				}
 			}
 
-			// we've loaded the wav data, so just return now
-			VLINE(sndBufferFloat);
-			fp.close();
-			return sndBufferFloat;
-			
+			// we've found the wav data, so just return now
+			VLINE((uint32_t)scount);
+			return rd;
 		}
 		else{ // skip an unknown chunk
 			if (chunksize > 0)
-				fp.seek(chunksize, SeekMode::SeekCur);
+				skip(io, fp, chunksize);
 		}
 	}
 
 	// didn't find data chunk, so fail
 	LINE;
-	fp.close();
+	io->close(fp);
 	return NULL;
 }
 
-static float clampf(float v, float min, float max){
-	return v < min ? min : (v > max ? max : v);
+int sf_wavreader_rate(sf_wavreader_st *rd){
+	return rd->rate;
 }
 
-// save a WAV file (returns false for error)
-bool sf_wavsave(sf_snd snd, const char *file){
-	File fp = SD.open(file, FILE_WRITE);
+int64_t sf_wavreader_size(sf_wavreader_st *rd){
+	return rd->size;
+}
+
+sf_wav_format sf_wavreader_format(sf_wavreader_st *rd){
+	return rd->format;
+}
+
+int64_t sf_wavreader_read(sf_wavreader_st *rd, int64_t count, sf_sample_st *output){
+	int64_t done = 0;
+	int framesize = rd->framesize;
+	while (done < count && rd->left > 0){
+		int64_t frames = rd->have / framesize;
+		if (frames == 0){
+			if (!reader_fill(rd))
+				return -1;
+			continue;
+		}
+		if (frames > count - done)
+			frames = count - done;
+		if (frames > rd->left)
+			frames = rd->left;
+		if (frames > CONVERT_MAXRUN)
+			frames = CONVERT_MAXRUN;
+
+		// convert the frames to stereo floating point, expanding mono to stereo
+		// stereo float32 data is already laid out like sf_sample_st, so it's just copied
+		const uint8_t *p = rd->buf + rd->bufpos;
+		float *out = (float *)(output + done);
+		bool mono = rd->numchannels == 1;
+		switch (rd->format){
+			case SF_WAV_PCM16:
+				if (mono)
+					sf_s16tof_mono(out, p, frames);
+				else
+					sf_s16tof(out, p, frames * 2);
+				break;
+			case SF_WAV_PCM24:
+				if (mono)
+					sf_s24tof_mono(out, p, frames);
+				else
+					sf_s24tof(out, p, frames * 2);
+				break;
+			case SF_WAV_FLOAT32:
+				if (mono)
+					sf_f32tof_mono(out, p, frames);
+				else
+					sf_f32tof(out, p, frames * 2);
+				break;
+		}
+		rd->bufpos += frames * framesize;
+		rd->have -= frames * framesize;
+		rd->left -= frames;
+		done += frames;
+	}
+	return done;
+}
+
+int64_t sf_wavreader_read_planar(sf_wavreader_st *rd, int64_t count, float *outputL,
+	float *outputR){
+	// decode through a small interleaved block on the stack, so no full size copy is needed
+	sf_sample_st tmp[PLANAR_BLOCK];
+	int64_t done = 0;
+	while (done < count){
+		int64_t n = count - done < PLANAR_BLOCK ? count - done : PLANAR_BLOCK;
+		n = sf_wavreader_read(rd, n, tmp);
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+		sf_deinterleave(n, tmp, outputL + done, outputR + done);
+		done += n;
+	}
+	return done;
+}
+
+void sf_wavreader_close(sf_wavreader_st *rd){
+	if (rd->map)
+		rd->io->unmap(rd->fh, rd->map, rd->mapsize);
+	else
+		sf_aligned_free(rd->buf);
+	rd->io->close(rd->fh);
+	sf_free(rd);
+}
+
+// load a WAV file (returns NULL for error)
+sf_snd sf_wavload(const char *file){
+	sf_wav_format format;
+	return sf_wavloadfmt(file, &format);
+}
+
+sf_snd sf_wavloadfmt(const char *file, sf_wav_format *format){
+	sf_wavreader_st *rd = sf_wavreader_open(file);
+	if (rd == NULL)
+		return NULL;
+	*format = rd->format;
+	sf_snd snd = sf_snd_new(rd->size, rd->rate, false);
+	if (snd == NULL){
+		sf_wavreader_close(rd);
+		return NULL;
+	}
+	if (sf_wavreader_read(rd, snd->size, snd->samples) != snd->size){
+		sf_wavreader_close(rd);
+		sf_snd_free(snd);
+		return NULL;
+	}
+	sf_wavreader_close(rd);
+	return snd;
+}
+
+sf_psnd sf_wavload_planar(const char *file, sf_wav_format *format){
+	sf_wavreader_st *rd = sf_wavreader_open(file);
+	if (rd == NULL)
+		return NULL;
+	if (format)
+		*format = rd->format;
+	sf_psnd snd = sf_psnd_new(rd->size, rd->rate, false);
+	if (snd == NULL){
+		sf_wavreader_close(rd);
+		return NULL;
+	}
+	if (sf_wavreader_read_planar(rd, snd->size, snd->L, snd->R) != snd->size){
+		sf_wavreader_close(rd);
+		sf_psnd_free(snd);
+		return NULL;
+	}
+	sf_wavreader_close(rd);
+	return snd;
+}
+
+// bytes per stereo sample frame for each output format
+static inline int format_framesize(sf_wav_format format){
+	return format == SF_WAV_PCM16 ? 4 : (format == SF_WAV_PCM24 ? 6 : 8);
+}
+
+// size of the header, with room for a ds64 chunk if requested
+static inline uint32_t format_hdrsize(sf_wav_format format, bool ds64){
+	return (format == SF_WAV_PCM16 ? 44 : 68) + (ds64 ? 36 : 0);
+}
+
+// largest number of samples that fits in the 32-bit sizes of a regular header
+static inline uint64_t format_maxsize(sf_wav_format format){
+	return (0xFFFFFFFFu - (format_hdrsize(format, false) - 8)) / format_framesize(format);
+}
+
+// fill in the header for a stereo file with `size` samples
+//
+// 16-bit files get the classic 44 byte header; 24-bit and float files get a 68 byte
+// WAVE_FORMAT_EXTENSIBLE header, which is what the spec asks for with more than 16 bits per sample
+//
+// if `ds64` is set, a 36 byte chunk is placed in front of the fmt chunk; it's a JUNK chunk as long
+// as the sizes fit in 32 bits, and turns into the ds64 chunk of an RF64 file otherwise
+static void put_header(uint8_t *p, int rate, uint64_t size, sf_wav_format format, bool ds64){
+	uint32_t fs = format_framesize(format);
+	uint32_t hdrsize = format_hdrsize(format, ds64);
+	uint64_t size2 = size * fs;               // total bytes of data
+	uint64_t sizeall = size2 + hdrsize - 8;   // total file size minus 8
+	bool rf64 = ds64 && sizeall > 0xFFFFFFFFu;
+	put_u32le(p +  0, rf64 ? 0x34364652 : 0x46464952); // 'RF64' or 'RIFF'
+	put_u32le(p +  4, rf64 ? 0xFFFFFFFF : (uint32_t)sizeall); // rest of file size
+	put_u32le(p +  8, 0x45564157);            // 'WAVE'
+	if (ds64){
+		memset(p + 12, 0, 36);
+		put_u32le(p + 12, rf64 ? 0x34367364 : 0x4B4E554A); // 'ds64' or 'JUNK'
+		put_u32le(p + 16, 28);                // size of ds64 chunk
+		if (rf64){
+			put_u64le(p + 20, sizeall);       // rest of file size
+			put_u64le(p + 28, size2);         // size of data chunk
+			put_u64le(p + 36, size);          // sample count
+		}
+		p += 36;
+	}
+	uint32_t fmtsize = format == SF_WAV_PCM16 ? 16 : 40;
+	put_u32le(p + 12, 0x20746D66);            // 'fmt '
+	put_u32le(p + 16, fmtsize);               // size of fmt chunk
+	put_u16le(p + 20, format == SF_WAV_PCM16 ? 1 : 0xFFFE); // audio format
+	put_u16le(p + 22, 2);                     // stereo
+	put_u32le(p + 24, rate);                  // sample rate
+	put_u32le(p + 28, rate * fs);             // bytes per second
+	put_u16le(p + 32, fs);                    // block align
+	put_u16le(p + 34, fs * 4);                // bits per sample
+	if (format != SF_WAV_PCM16){
+		put_u16le(p + 36, 22);                // size of extension
+		put_u16le(p + 38, fs * 4);            // valid bits per sample
+		put_u32le(p + 40, 3);                 // channel mask (front left, front right)
+		// sub-format GUID: xxxxxxxx-0000-0010-8000-00AA00389B71, where x is the format code
+		put_u32le(p + 44, format == SF_WAV_FLOAT32 ? 3 : 1);
+		put_u32le(p + 48, 0x00100000);
+		put_u32le(p + 52, 0xAA000080);
+		put_u32le(p + 56, 0x719B3800);
+	}
+	put_u32le(p + fmtsize + 20, 0x61746164);  // 'data'
+	put_u32le(p + fmtsize + 24, rf64 ? 0xFFFFFFFF : (uint32_t)size2); // size of data chunk
+}
+
+// write out a block of staged bytes (or the last partial block), or if the writer is mapped and the
+// mapping is full, drop the mapping and continue with a regular block buffer
+//
+// the block buffer has room for SF_WAV_BLOCKSIZE bytes plus a partial frame, so frame sizes that
+// don't divide the block size still get written out in whole blocks; the bytes past the block are
+// carried over to the front of the buffer
+static bool writer_flush(sf_wavwriter_st *wr){
+	if (wr->map){
+		uint64_t mapsize = wr->cap;
+		wr->io->unmap(wr->fh, wr->map, mapsize);
+		wr->map = NULL;
+		wr->cap = SF_WAV_BLOCKSIZE + wr->framesize - 1;
+		wr->buf = (uint8_t *)sf_aligned_malloc(sf_alignsize(wr->cap), SF_ALIGN);
+		wr->len = 0;
+		if (wr->buf == NULL || !wr->io->seek(wr->fh, mapsize))
+			return false;
+		return true;
+	}
+	uint32_t n = wr->len < SF_WAV_BLOCKSIZE ? (uint32_t)wr->len : SF_WAV_BLOCKSIZE;
+	if (n > 0 && wr->io->write(wr->fh, wr->buf, n) != (int)n)
+		return false;
+	wr->len -= n;
+	if (wr->len > 0)
+		memmove(wr->buf, wr->buf + n, wr->len);
+	return true;
+}
+
+sf_wavwriter_st *sf_wavwriter_open(const char *file, int rate, int64_t sizehint){
+	return sf_wavwriter_openfmt(file, rate, sizehint, SF_WAV_PCM16);
+}
+
+sf_wavwriter_st *sf_wavwriter_openfmt(const char *file, int rate, int64_t sizehint,
+	sf_wav_format format){
+	if (sizehint < 0 || (uint64_t)sizehint > INT64_MAX / 8)
+		return NULL; // sample too large
+
+	const sf_wavio_st *io = sf_wavio;
+	void *fp = io->open(file, true);
 	if (fp == NULL)
+		return NULL;
+
+	sf_wavwriter_st *wr = (sf_wavwriter_st *)sf_malloc(sizeof(sf_wavwriter_st));
+	if (wr == NULL){
+		io->close(fp);
+		return NULL;
+	}
+	wr->io   = io;
+	wr->fh   = fp;
+	wr->rate = rate;
+	wr->size = 0;
+	wr->hint = sizehint;
+	wr->ds64 = sizehint == 0 || (uint64_t)sizehint > format_maxsize(format);
+	wr->hdrsize = format_hdrsize(format, wr->ds64);
+	wr->framesize = format_framesize(format);
+	wr->format = format;
+	wr->ok   = true;
+	wr->dither = false;
+	wr->map  = NULL;
+	wr->buf  = NULL;
+
+	// if the final size is known, grow the file to that size up front, so the filesystem can
+	// allocate it in one go
+	//
+	// if the backend can map the file, then the samples are converted straight into the mapping;
+	// otherwise everything is staged in a block buffer, and only whole blocks are written out
+	// (except for the last one), so every write lands on a block boundary of the file
+	uint64_t filesize = wr->hdrsize + (uint64_t)sizehint * wr->framesize;
+	if (sizehint > 0 && io->map && io->resize(fp, filesize)){
+		wr->map = io->map(fp, filesize, true);
+		if (wr->map){
+			wr->buf = (uint8_t *)wr->map;
+			wr->cap = filesize;
+		}
+	}
+	if (wr->map == NULL){
+#if SF_WAV_PREALLOCATE
+		if (sizehint > 0 && !io->resize(fp, filesize)){
+			sf_free(wr);
+			io->close(fp);
+			return NULL;
+		}
+#endif
+		wr->cap = SF_WAV_BLOCKSIZE + wr->framesize - 1;
+		wr->buf = (uint8_t *)sf_aligned_malloc(sf_alignsize(wr->cap), SF_ALIGN);
+		if (wr->buf == NULL){
+			sf_free(wr);
+			io->close(fp);
+			return NULL;
+		}
+	}
+
+	// the header is written with a size of 0 for now, and rewritten when the writer is closed
+	put_header(wr->buf, rate, 0, format, wr->ds64);
+	wr->len = wr->hdrsize;
+	return wr;
+}
+
+bool sf_wavwriter_write(sf_wavwriter_st *wr, int64_t count, const sf_sample_st *input){
+	// without room for a ds64 chunk, the file has to stay within the 32-bit sizes
+	uint64_t maxsize = wr->ds64 ? INT64_MAX / 8 : format_maxsize(wr->format);
+	if (count < 0 || wr->size + count > maxsize)
+		wr->ok = false; // sample too large
+	if (!wr->ok)
 		return false;
 
-	// calculate the different file sizes based on sample size
-	uint32_t size2 = snd->size * 4; // total bytes of data
-	uint32_t sizeall = size2 + 36; // total file size minus 8
-	if (snd->size > size2 || snd->size > sizeall || size2 > sizeall)
-		return false; // sample too large
-
-	write_u32le(fp, 0x46464952);    // 'RIFF'
-	write_u32le(fp, sizeall);       // rest of file size
-	write_u32le(fp, 0x45564157);    // 'WAVE'
-	write_u32le(fp, 0x20746D66);    // 'fmt '
-	write_u32le(fp, 16);            // size of fmt chunk
-	write_u16le(fp, 1);             // audio format
-	write_u16le(fp, 2);             // stereo
-	write_u32le(fp, snd->rate);     // sample rate
-	write_u32le(fp, snd->rate * 4); // bytes per second
-	write_u16le(fp, 4);             // block align
-	write_u16le(fp, 16);            // bits per sample
-	write_u32le(fp, 0x61746164);    // 'data'
-	write_u32le(fp, size2);         // size of data chunk
-
-	// convert the sample to stereo 16-bit, and write to file
-	for (int i = 0; i < snd->size; i++){
-		float L = clampf(snd->samples[i].L, -1, 1);
-		float R = clampf(snd->samples[i].R, -1, 1);
-		int16_t Lv, Rv;
-		// once again, int16 samples range from -32768 to 32767, so we need to scale the floating
-		// point sample by a different factor depending on whether it's negative
-		if (L < 0)
-			Lv = (int16_t)(L * 32768.0f);
-		else
-			Lv = (int16_t)(L * 32767.0f);
-		if (R < 0)
-			Rv = (int16_t)(R * 32768.0f);
-		else
-			Rv = (int16_t)(R * 32767.0f);
-		write_u16le(fp, (uint16_t)Lv);
-		write_u16le(fp, (uint16_t)Rv);
+	// convert the samples to the output format in runs that fill up the buffer, and write to file
+	int fs = wr->framesize;
+	int64_t i = 0;
+	while (i < count){
+		int64_t frames = (wr->cap - wr->len) / fs;
+		if (frames == 0){
+			if (!writer_flush(wr)){
+				wr->ok = false;
+				return false;
+			}
+			continue;
+		}
+		if (frames > count - i)
+			frames = count - i;
+		if (frames > CONVERT_MAXRUN)
+			frames = CONVERT_MAXRUN;
+		uint8_t *out = wr->buf + wr->len;
+		const float *in = (const float *)(input + i);
+		int n = (int)frames * 2;
+		switch (wr->format){
+			case SF_WAV_PCM16:
+				sf_ftos16(out, in, n, wr->dither ? &wr->ds : NULL);
+				break;
+			case SF_WAV_PCM24:
+				sf_ftos24(out, in, n);
+				break;
+			case SF_WAV_FLOAT32:
+				sf_ftof32(out, in, n);
+				break;
+		}
+		wr->len += frames * fs;
+		i += frames;
 	}
+	wr->size += count;
+	return true;
+}
 
-	fp.close();
+bool sf_wavwriter_write_planar(sf_wavwriter_st *wr, int64_t count, const float *inputL,
+	const float *inputR){
+	sf_sample_st tmp[PLANAR_BLOCK];
+	for (int64_t i = 0; i < count; i += PLANAR_BLOCK){
+		int64_t n = count - i < PLANAR_BLOCK ? count - i : PLANAR_BLOCK;
+		sf_interleave(n, inputL + i, inputR + i, tmp);
+		if (!sf_wavwriter_write(wr, n, tmp))
+			return false;
+	}
 	return true;
 }
+
+void sf_wavwriter_setdither(sf_wavwriter_st *wr, bool dither){
+	if (dither && !wr->dither)
+		sf_dither_init(&wr->ds, 0);
+	wr->dither = dither;
+}
+
+bool sf_wavwriter_close(sf_wavwriter_st *wr){
+	bool ok = wr->ok;
+	const sf_wavio_st *io = wr->io;
+
+	// flush the last partial block (or drop the mapping), and trim the file if it was grown for
+	// more samples than were written
+	if (wr->map)
+		io->unmap(wr->fh, wr->map, wr->cap);
+	else{
+		while (ok && wr->len > 0)
+			ok = writer_flush(wr);
+		sf_aligned_free(wr->buf);
+	}
+	if (ok && wr->size < wr->hint)
+		ok = io->resize(wr->fh, wr->hdrsize + wr->size * wr->framesize);
+
+	// rewrite the header with the final sizes (which might turn the file into RF64)
+	if (ok){
+		uint8_t hdr[104];
+		put_header(hdr, wr->rate, wr->size, wr->format, wr->ds64);
+		ok = io->seek(wr->fh, 0) && io->write(wr->fh, hdr, wr->hdrsize) == (int)wr->hdrsize;
+	}
+
+	io->close(wr->fh);
+	sf_free(wr);
+	return ok;
+}
+
+// save a WAV file (returns false for error)
+bool sf_wavsave(sf_snd snd, const char *file){
+	return sf_wavsavefmt(snd, file, SF_WAV_PCM16);
+}
+
+bool sf_wavsavefmt(sf_snd snd, const char *file, sf_wav_format format){
+	sf_wavwriter_st *wr = sf_wavwriter_openfmt(file, snd->rate, snd->size, format);
+	if (wr == NULL)
+		return false;
+	bool ok = sf_wavwriter_write(wr, snd->size, snd->samples);
+	return sf_wavwriter_close(wr) && ok;
+}
+
+bool sf_wavsave_planar(sf_psnd snd, const char *file, sf_wav_format format){
+	sf_wavwriter_st *wr = sf_wavwriter_openfmt(file, snd->rate, snd->size, format);
+	if (wr == NULL)
+		return false;
+	bool ok = sf_wavwriter_write_planar(wr, snd->size, snd->L, snd->R);
+	return sf_wavwriter_close(wr) && ok;
+}
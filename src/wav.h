@@ -6,15 +6,145 @@
 //
 
 // simple .wav file loading and saving
-// only handles loading 1 or 2 channel WAVs with 16-bit samples
-// only saves 2 channel WAVs with 16-bit samples
+// only handles loading 1 or 2 channel WAVs with 16-bit or 24-bit PCM or 32-bit float samples
+// (including WAVE_FORMAT_EXTENSIBLE headers, and RF64/BW64 files larger than 4GB)
+// only saves 2 channel WAVs, with 16-bit samples unless another format is requested
+// file access goes through a pluggable backend (SD card on Arduino, POSIX with mmap on hosts)
 
 #ifndef SNDFILTER_WAV__H
 #define SNDFILTER_WAV__H
 
 #include "snd.h"
+#include <stdint.h>
+
+// size of the blocks used when reading and writing the sample data; I/O is aligned to multiples of
+// this size within the file, so it's best to keep it a multiple of the SD card's cluster size
+// (4K to 32K)
+#ifndef SF_WAV_BLOCKSIZE
+#define SF_WAV_BLOCKSIZE  8192
+#endif
+#if SF_WAV_BLOCKSIZE % 4 != 0
+#error SF_WAV_BLOCKSIZE must be a multiple of 4
+#endif
+
+// set to 1 to have sf_wavsave grow the file to its final size before writing any samples, so the
+// filesystem can allocate the clusters in one contiguous run instead of fragmenting long files
+#ifndef SF_WAV_PREALLOCATE
+#define SF_WAV_PREALLOCATE  1
+#endif
+
+// sample formats
+typedef enum {
+	SF_WAV_PCM16,  // 16-bit integer
+	SF_WAV_PCM24,  // 24-bit integer
+	SF_WAV_FLOAT32 // 32-bit float, not clamped to [-1, 1]
+} sf_wav_format;
 
 sf_snd sf_wavload(const char *file);
 bool   sf_wavsave(sf_snd snd, const char *file);
 
+// same as above, but reports the format of the loaded file, or saves in a specific format
+sf_snd sf_wavloadfmt(const char *file, sf_wav_format *format);
+bool   sf_wavsavefmt(sf_snd snd, const char *file, sf_wav_format format);
+
+// planar versions of the above (`format` can be NULL when loading)
+sf_psnd sf_wavload_planar(const char *file, sf_wav_format *format);
+bool    sf_wavsave_planar(sf_psnd snd, const char *file, sf_wav_format format);
+
+// I/O backend
+//
+// all file access goes through the backend pointed to by sf_wavio, which defaults to sf_wavio_sd on
+// Arduino and sf_wavio_posix everywhere else; overwrite it to read and write through something else
+//
+// `map` and `unmap` are optional (NULL if unsupported); when available, the reader decodes straight
+// out of the mapped file and the writer converts straight into a mapped file of the final size
+typedef struct {
+	void *   (*open)  (const char *file, bool write); // returns NULL for error
+	void     (*close) (void *fh);
+	int      (*read)  (void *fh, void *buf, int size); // returns bytes read
+	int      (*write) (void *fh, const void *buf, int size); // returns bytes written
+	bool     (*seek)  (void *fh, uint64_t pos); // absolute position
+	uint64_t (*tell)  (void *fh);
+	uint64_t (*size)  (void *fh);
+	bool     (*resize)(void *fh, uint64_t size); // grow (or shrink, if supported) the file
+	void *   (*map)   (void *fh, uint64_t size, bool write); // map the first `size` bytes
+	void     (*unmap) (void *fh, void *ptr, uint64_t size);
+} sf_wavio_st;
+
+#if defined(ARDUINO)
+extern const sf_wavio_st sf_wavio_sd;    // Arduino SD library
+#else
+extern const sf_wavio_st sf_wavio_posix; // POSIX files, memory mapped where possible
+#endif
+
+extern const sf_wavio_st *sf_wavio;
+
+// streaming API
+//
+// sf_wavload and sf_wavsave need the whole sound in memory, which doesn't work for long files; the
+// streaming API lets you move the samples through a small buffer instead, so memory use doesn't
+// depend on the length of the file
+//
+// for example, to filter a file 1024 samples at a time:
+//
+//   sf_wavreader_st *rd = sf_wavreader_open("input.wav");
+//   sf_wavwriter_st *wr = sf_wavwriter_open("output.wav", sf_wavreader_rate(rd),
+//     sf_wavreader_size(rd));
+//   sf_sample_st buf[1024];
+//   int64_t n;
+//   while ((n = sf_wavreader_read(rd, 1024, buf)) > 0){
+//     sf_biquad_process(&state, n, buf, buf);
+//     sf_wavwriter_write(wr, n, buf);
+//   }
+//   sf_wavreader_close(rd);
+//   sf_wavwriter_close(wr);
+
+typedef struct sf_wavreader_st sf_wavreader_st;
+typedef struct sf_wavwriter_st sf_wavwriter_st;
+
+// open a WAV file for reading and parse the header (returns NULL for error)
+sf_wavreader_st *sf_wavreader_open(const char *file);
+
+// sample rate, total number of samples, and sample format of the file being read
+int sf_wavreader_rate(sf_wavreader_st *rd);
+int64_t sf_wavreader_size(sf_wavreader_st *rd);
+sf_wav_format sf_wavreader_format(sf_wavreader_st *rd);
+
+// read up to `count` samples into `output`, converted to stereo floating point
+// returns the number of samples read, 0 at the end of the data, or -1 for error
+int64_t sf_wavreader_read(sf_wavreader_st *rd, int64_t count, sf_sample_st *output);
+
+// same as above, but splits the channels into separate buffers
+int64_t sf_wavreader_read_planar(sf_wavreader_st *rd, int64_t count, float *outputL,
+	float *outputR);
+
+void sf_wavreader_close(sf_wavreader_st *rd);
+
+// open a WAV file for writing (returns NULL for error)
+// `sizehint` is the expected number of samples, used to preallocate the file if enabled; it should
+// either be exact or 0 for unknown
+// files that end up larger than 4GB are written as RF64; this needs room for a ds64 chunk in the
+// header, which is reserved (as a JUNK chunk) when `sizehint` is 0 or too big for a regular WAV
+sf_wavwriter_st *sf_wavwriter_open(const char *file, int rate, int64_t sizehint);
+
+// same as above, but writes samples in `format` instead of 16-bit
+// formats other than SF_WAV_PCM16 are written with a WAVE_FORMAT_EXTENSIBLE header
+sf_wavwriter_st *sf_wavwriter_openfmt(const char *file, int rate, int64_t sizehint,
+	sf_wav_format format);
+
+// append `count` samples to the file (returns false for error)
+bool sf_wavwriter_write(sf_wavwriter_st *wr, int64_t count, const sf_sample_st *input);
+
+// same as above, but takes the channels from separate buffers
+bool sf_wavwriter_write_planar(sf_wavwriter_st *wr, int64_t count, const float *inputL,
+	const float *inputR);
+
+// enable or disable TPDF dither for the samples written after this call (off by default)
+// only applies to SF_WAV_PCM16
+void sf_wavwriter_setdither(sf_wavwriter_st *wr, bool dither);
+
+// flush the remaining samples, patch the header with the final size, and close the file (returns
+// false if anything failed since the writer was opened)
+bool sf_wavwriter_close(sf_wavwriter_st *wr);
+
 #endif // SNDFILTER_WAV__H
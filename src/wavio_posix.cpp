@@ -0,0 +1,115 @@
+//
+// sndfilter - Algorithms for sound filters, like reverb, lowpass, etc
+// by Sean Connelly (@velipso), https://sean.fun
+// Project Home: https://github.com/velipso/sndfilter
+// SPDX-License-Identifier: 0BSD
+//
+
+// I/O backend for POSIX hosts, using mmap for the sample data
+
+#if !defined(ARDUINO)
+
+// use a 64-bit off_t even on 32-bit hosts, so RF64 files over 4GB work
+#define _FILE_OFFSET_BITS  64
+
+#include "wav.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// file descriptors are stored directly in the handle, offset by one so that 0 can mean failure
+static inline int fd(void *fh){
+	return (int)(intptr_t)fh - 1;
+}
+
+static void *posix_open(const char *file, bool write){
+	int f = write ? open(file, O_RDWR | O_CREAT | O_TRUNC, 0644) : open(file, O_RDONLY);
+	if (f < 0)
+		return NULL;
+	return (void *)(intptr_t)(f + 1);
+}
+
+static void posix_close(void *fh){
+	close(fd(fh));
+}
+
+static int posix_read(void *fh, void *buf, int size){
+	// read() can return less than asked for, so keep going until the end of the file
+	int done = 0;
+	while (done < size){
+		ssize_t got = read(fd(fh), (char *)buf + done, size - done);
+		if (got <= 0)
+			break;
+		done += got;
+	}
+	return done;
+}
+
+static int posix_write(void *fh, const void *buf, int size){
+	int done = 0;
+	while (done < size){
+		ssize_t put = write(fd(fh), (const char *)buf + done, size - done);
+		if (put <= 0)
+			break;
+		done += put;
+	}
+	return done;
+}
+
+static bool posix_seek(void *fh, uint64_t pos){
+	return lseek(fd(fh), (off_t)pos, SEEK_SET) == (off_t)pos;
+}
+
+static uint64_t posix_tell(void *fh){
+	return (uint64_t)lseek(fd(fh), 0, SEEK_CUR);
+}
+
+static uint64_t posix_size(void *fh){
+	struct stat st;
+	if (fstat(fd(fh), &st) != 0)
+		return 0;
+	return (uint64_t)st.st_size;
+}
+
+static bool posix_resize(void *fh, uint64_t size){
+	if (ftruncate(fd(fh), (off_t)size) != 0)
+		return false;
+#if defined(__linux__)
+	// actually reserve the blocks, so the file isn't sparse and writes through the mapping can't
+	// fail with SIGBUS on a full disk; not every filesystem supports it, so failure is ignored
+	posix_fallocate(fd(fh), 0, (off_t)size);
+#endif
+	return true;
+}
+
+static void *posix_map(void *fh, uint64_t size, bool write){
+	if (size == 0 || size > SIZE_MAX)
+		return NULL; // too big for the address space (on 32-bit hosts)
+	void *p = mmap(NULL, size, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd(fh), 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	// the data is read and written front to back
+	madvise(p, size, MADV_SEQUENTIAL);
+	return p;
+}
+
+static void posix_unmap(void *fh, void *ptr, uint64_t size){
+	(void)fh;
+	munmap(ptr, size);
+}
+
+const sf_wavio_st sf_wavio_posix = {
+	posix_open,
+	posix_close,
+	posix_read,
+	posix_write,
+	posix_seek,
+	posix_tell,
+	posix_size,
+	posix_resize,
+	posix_map,
+	posix_unmap
+};
+
+#endif // !ARDUINO
@@ -0,0 +1,90 @@
+//
+// sndfilter - Algorithms for sound filters, like reverb, lowpass, etc
+// by Sean Connelly (@velipso), https://sean.fun
+// Project Home: https://github.com/velipso/sndfilter
+// SPDX-License-Identifier: 0BSD
+//
+
+// I/O backend for the Arduino SD library
+
+#if defined(ARDUINO)
+
+#include "wav.h"
+#include "mem.h"
+#include <new>
+#include <SPI.h>
+#include <SD.h>
+
+static void *sd_open(const char *file, bool write){
+	File fp = SD.open(file, write ? FILE_WRITE : FILE_READ);
+	if (!fp)
+		return NULL;
+	// the handle is a File object, so it needs to be constructed in place
+	void *mem = sf_malloc(sizeof(File));
+	if (mem == NULL){
+		fp.close();
+		return NULL;
+	}
+	return new (mem) File(fp);
+}
+
+static void sd_close(void *fh){
+	File *fp = (File *)fh;
+	fp->close();
+	fp->~File();
+	sf_free(fp);
+}
+
+static int sd_read(void *fh, void *buf, int size){
+	return ((File *)fh)->read((uint8_t *)buf, size);
+}
+
+static int sd_write(void *fh, const void *buf, int size){
+	return ((File *)fh)->write((const uint8_t *)buf, size);
+}
+
+// FAT32 files can't be larger than 4GB, so positions past that always fail
+static bool sd_seek(void *fh, uint64_t pos){
+	if (pos > 0xFFFFFFFFu)
+		return false;
+	return ((File *)fh)->seek(pos, SeekMode::SeekSet);
+}
+
+static uint64_t sd_tell(void *fh){
+	return ((File *)fh)->position();
+}
+
+static uint64_t sd_size(void *fh){
+	return ((File *)fh)->size();
+}
+
+// grow the file by writing its last byte, so FAT allocates all the clusters in one go
+// FAT can't be shrunk through the SD library, so a smaller size is silently ignored
+static bool sd_resize(void *fh, uint64_t size){
+	if (size > 0xFFFFFFFFu)
+		return false;
+	File *fp = (File *)fh;
+	uint32_t cur = fp->size();
+	if (size <= cur)
+		return true;
+	uint32_t pos = fp->position();
+	uint8_t zero = 0;
+	if (!fp->seek(size - 1, SeekMode::SeekSet) || fp->write(&zero, 1) != 1)
+		return false;
+	return fp->seek(pos, SeekMode::SeekSet);
+}
+
+const sf_wavio_st sf_wavio_sd = {
+	sd_open,
+	sd_close,
+	sd_read,
+	sd_write,
+	sd_seek,
+	sd_tell,
+	sd_size,
+	sd_resize,
+	NULL, // no memory mapping on the SD card
+	NULL
+};
+
+#endif // ARDUINO
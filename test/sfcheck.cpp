@@ -0,0 +1,390 @@
+//
+// sndfilter - Algorithms for sound filters, like reverb, lowpass, etc
+// by Sean Connelly (@velipso), https://sean.fun
+// Project Home: https://github.com/velipso/sndfilter
+// SPDX-License-Identifier: 0BSD
+//
+
+// correctness checks for the filters
+// this is meant to be built and run on a host machine via `./build sfcheck`
+//
+// every check prints a line starting with "ok" or "FAIL", and the program exits with 1 if any
+// check failed
+
+#include "../src/biquad.h"
+#include "../src/offline.h"
+#include "../src/compressor.h"
+#include "../src/reverb.h"
+#include "../src/mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#define RATE     44100
+#define SAMPLES  (1 << 17) // about 3 seconds
+#define BLOCK    1024      // a multiple of SF_COMPRESSOR_SPU, so the compressor writes every sample
+
+static int failures = 0;
+
+static void check(bool pass, const char *name){
+	printf("%s %s\n", pass ? "ok  " : "FAIL", name);
+	if (!pass)
+		failures++;
+}
+
+// a deterministic stereo test signal: a tone in each channel plus white noise, with a stretch of
+// silence in the middle, so the filters also ring out
+static void fill(sf_sample_st *samples, int64_t size){
+	uint32_t seed = 1;
+	for (int64_t i = 0; i < size; i++){
+		seed = seed * 1664525 + 1013904223;
+		float noise = (float)(seed >> 8) / 16777216.0f - 0.5f;
+		bool quiet = i > size / 3 && i < size * 2 / 3;
+		samples[i].L = quiet ? 0 : 0.5f * sinf((float)i * 0.031f) + 0.2f * noise;
+		samples[i].R = quiet ? 0 : 0.5f * sinf((float)i * 0.0471f) - 0.2f * noise;
+	}
+}
+
+//
+// in-place processing
+//
+// every process function runs over the signal block by block twice, from two copies of the same
+// state: once into a separate output buffer, and once with the input as the output; the results
+// must be identical
+//
+
+typedef enum {
+	FILTER_BIQUAD,
+	FILTER_COMPRESSOR,
+	FILTER_REVERB
+} filter_type;
+
+static const char *filternames[] = { "biquad", "compressor", "reverb" };
+
+typedef struct {
+	filter_type type;
+	sf_biquad_state_st biquad;
+	sf_compressor_state_st *compressor;
+	sf_reverb_state_st *reverb;
+} filter_st;
+
+static bool filter_init(filter_st *f, filter_type type){
+	f->type = type;
+	f->compressor = NULL;
+	f->reverb = NULL;
+	switch (type){
+		case FILTER_BIQUAD:
+			sf_peaking(&f->biquad, RATE, 1000, 1, 6);
+			return true;
+		case FILTER_COMPRESSOR:
+			f->compressor = (sf_compressor_state_st *)sf_malloc(sizeof(sf_compressor_state_st));
+			if (f->compressor == NULL)
+				return false;
+			sf_simplecomp(f->compressor, RATE, 5, -24, 30, 12, 0.003f, 0.25f);
+			return true;
+		case FILTER_REVERB:
+			f->reverb = sf_reverb_new(RATE, SF_REVERB_PRESET_MEDIUMHALL1);
+			return f->reverb != NULL;
+	}
+	return false;
+}
+
+static void filter_free(filter_st *f){
+	if (f->compressor)
+		sf_free(f->compressor);
+	if (f->reverb)
+		sf_reverb_free(f->reverb);
+}
+
+static void filter_process(filter_st *f, int64_t size, sf_sample_st *input, sf_sample_st *output){
+	switch (f->type){
+		case FILTER_BIQUAD:
+			sf_biquad_process(&f->biquad, size, input, output);
+			break;
+		case FILTER_COMPRESSOR:
+			sf_compressor_process(f->compressor, size, input, output);
+			break;
+		case FILTER_REVERB:
+			sf_reverb_process(f->reverb, size, input, output);
+			break;
+	}
+}
+
+static void filter_process_planar(filter_st *f, int64_t size, const float *inputL,
+	const float *inputR, float *outputL, float *outputR){
+	switch (f->type){
+		case FILTER_BIQUAD:
+			sf_biquad_process_planar(&f->biquad, size, inputL, inputR, outputL, outputR);
+			break;
+		case FILTER_COMPRESSOR:
+			sf_compressor_process_planar(f->compressor, size, inputL, inputR, outputL, outputR);
+			break;
+		case FILTER_REVERB:
+			sf_reverb_process_planar(f->reverb, size, inputL, inputR, outputL, outputR);
+			break;
+	}
+}
+
+static void check_inplace(filter_type type, const sf_sample_st *signal){
+	char name[100];
+	filter_st separate, inplace;
+	bool ready = filter_init(&separate, type);
+	ready = filter_init(&inplace, type) && ready;
+	sf_sample_st *input = (sf_sample_st *)sf_malloc(sizeof(sf_sample_st) * SAMPLES);
+	sf_sample_st *output = (sf_sample_st *)sf_malloc(sizeof(sf_sample_st) * SAMPLES);
+	sf_sample_st *buf = (sf_sample_st *)sf_malloc(sizeof(sf_sample_st) * SAMPLES);
+	float *planar = (float *)sf_malloc(sizeof(float) * SAMPLES * 6);
+	if (!ready || input == NULL || output == NULL || buf == NULL || planar == NULL){
+		snprintf(name, sizeof(name), "%s in place (out of memory)", filternames[type]);
+		check(false, name);
+		goto cleanup;
+	}
+
+	// interleaved
+	memcpy(input, signal, sizeof(sf_sample_st) * SAMPLES);
+	memcpy(buf, signal, sizeof(sf_sample_st) * SAMPLES);
+	for (int64_t i = 0; i < SAMPLES; i += BLOCK){
+		int64_t size = SAMPLES - i < BLOCK ? SAMPLES - i : BLOCK;
+		filter_process(&separate, size, &input[i], &output[i]);
+		filter_process(&inplace, size, &buf[i], &buf[i]);
+	}
+	snprintf(name, sizeof(name), "%s in place", filternames[type]);
+	check(memcmp(input, signal, sizeof(sf_sample_st) * SAMPLES) == 0 &&
+		memcmp(output, buf, sizeof(sf_sample_st) * SAMPLES) == 0, name);
+
+	// planar, continuing from the same states
+	{
+		float *inL = &planar[0];
+		float *inR = &planar[SAMPLES];
+		float *outL = &planar[SAMPLES * 2];
+		float *outR = &planar[SAMPLES * 3];
+		float *bufL = &planar[SAMPLES * 4];
+		float *bufR = &planar[SAMPLES * 5];
+		for (int64_t i = 0; i < SAMPLES; i++){
+			inL[i] = bufL[i] = signal[i].L;
+			inR[i] = bufR[i] = signal[i].R;
+		}
+		for (int64_t i = 0; i < SAMPLES; i += BLOCK){
+			int64_t size = SAMPLES - i < BLOCK ? SAMPLES - i : BLOCK;
+			filter_process_planar(&separate, size, &inL[i], &inR[i], &outL[i], &outR[i]);
+			filter_process_planar(&inplace, size, &bufL[i], &bufR[i], &bufL[i], &bufR[i]);
+		}
+		snprintf(name, sizeof(name), "%s planar in place", filternames[type]);
+		check(memcmp(outL, bufL, sizeof(float) * SAMPLES) == 0 &&
+			memcmp(outR, bufR, sizeof(float) * SAMPLES) == 0, name);
+	}
+
+cleanup:
+	sf_free(input);
+	sf_free(output);
+	sf_free(buf);
+	sf_free(planar);
+	filter_free(&separate);
+	filter_free(&inplace);
+}
+
+//
+// parallel biquads
+//
+// a whole sound filtered across threads must be as accurate as filtering it on one thread, even
+// for poles near the unit circle, where the chunks ring for a long time; both are measured against
+// the same filter in double precision, and must end with the history of the outputs they wrote
+//
+
+#define PARALLEL_SAMPLES  (1 << 19)
+
+// white noise, which excites the resonances as much as anything would
+static void fill_noise(sf_sample_st *samples, int64_t size){
+	uint32_t seed = 7;
+	for (int64_t i = 0; i < size; i++){
+		seed = seed * 1664525 + 1013904223;
+		samples[i].L = (float)(seed >> 8) / 8388608.0f - 1.0f;
+		seed = seed * 1664525 + 1013904223;
+		samples[i].R = (float)(seed >> 8) / 8388608.0f - 1.0f;
+	}
+}
+
+// filter the left channel of `input` through `count` sections in double precision
+static void reference(const sf_biquad_state_st *sections, int count, int64_t size,
+	const sf_sample_st *input, double *output){
+	for (int64_t i = 0; i < size; i++)
+		output[i] = input[i].L;
+	for (int s = 0; s < count; s++){
+		const sf_biquad_state_st *bq = &sections[s];
+		double xn1 = 0, xn2 = 0, yn1 = 0, yn2 = 0;
+		for (int64_t i = 0; i < size; i++){
+			double xn0 = output[i];
+			double yn0 = bq->b0 * xn0 + bq->b1 * xn1 + bq->b2 * xn2 - bq->a1 * yn1 - bq->a2 * yn2;
+			xn2 = xn1;
+			xn1 = xn0;
+			yn2 = yn1;
+			yn1 = yn0;
+			output[i] = yn0;
+		}
+	}
+}
+
+static double maxerror(int64_t size, const sf_sample_st *output, const double *ref){
+	double worst = 0;
+	for (int64_t i = 0; i < size; i++){
+		double e = fabs(output[i].L - ref[i]);
+		if (e > worst)
+			worst = e;
+	}
+	return worst;
+}
+
+static bool same_sample(sf_sample_st a, sf_sample_st b){
+	return a.L == b.L && a.R == b.R;
+}
+
+// the history left in `bq` must be the last outputs written, so the next call doesn't step
+static bool ends_at(const sf_biquad_state_st *bq, int64_t size, const sf_sample_st *output){
+	return same_sample(bq->yn1, output[size - 1]) && same_sample(bq->yn2, output[size - 2]);
+}
+
+static void check_parallel(const char *label, const sf_biquad_state_st *sections, int count,
+	const sf_sample_st *signal, sf_sample_st *output, double *ref){
+	char name[100];
+	reference(sections, count, PARALLEL_SAMPLES, signal, ref);
+
+	sf_biquad_chain_st chain;
+	sf_biquad_chain_init(&chain);
+	for (int s = 0; s < count; s++)
+		sf_biquad_chain_add(&chain, &sections[s]);
+	sf_biquad_chain_process(&chain, PARALLEL_SAMPLES, (sf_sample_st *)signal, output);
+	double serial = maxerror(PARALLEL_SAMPLES, output, ref);
+
+	for (int threads = 2; threads <= 16; threads *= 2){
+		sf_biquad_chain_init(&chain);
+		for (int s = 0; s < count; s++)
+			sf_biquad_chain_add(&chain, &sections[s]);
+		memcpy(output, signal, sizeof(sf_sample_st) * PARALLEL_SAMPLES);
+		sf_biquad_chain_process_parallel(&chain, PARALLEL_SAMPLES, output, output, threads);
+		double parallel = maxerror(PARALLEL_SAMPLES, output, ref);
+		snprintf(name, sizeof(name), "%s on %d threads (error %.2g, serial %.2g)", label,
+			threads, parallel, serial);
+		check(parallel <= serial * 2 && ends_at(&chain.sections[count - 1], PARALLEL_SAMPLES,
+			output), name);
+	}
+}
+
+// filter the left channel of `input` forwards and backwards in double precision, with the same
+// padding and starting history as sf_biquad_filtfilt (returns false if out of memory)
+static bool reference_filtfilt(const sf_biquad_state_st *bq, int64_t size,
+	const sf_sample_st *input, double *output){
+	int64_t padlen = size - 1 < SF_OFFLINE_PADLEN ? size - 1 : SF_OFFLINE_PADLEN;
+	int64_t total = size + padlen * 2;
+	double *x = (double *)sf_malloc(sizeof(double) * total);
+	if (x == NULL)
+		return false;
+	for (int64_t k = 0; k < padlen; k++){
+		x[k] = 2.0 * input[0].L - input[padlen - k].L;
+		x[padlen + size + k] = 2.0 * input[size - 1].L - input[size - 2 - k].L;
+	}
+	for (int64_t i = 0; i < size; i++)
+		x[padlen + i] = input[i].L;
+	double gain = (bq->b0 + bq->b1 + (double)bq->b2) / (1.0 + bq->a1 + bq->a2);
+	for (int pass = 0; pass < 2; pass++){
+		double xn1 = x[0], xn2 = x[0], yn1 = x[0] * gain, yn2 = yn1;
+		for (int64_t i = 0; i < total; i++){
+			double xn0 = x[i];
+			double yn0 = bq->b0 * xn0 + bq->b1 * xn1 + bq->b2 * xn2 - bq->a1 * yn1 - bq->a2 * yn2;
+			xn2 = xn1;
+			xn1 = xn0;
+			yn2 = yn1;
+			yn1 = yn0;
+			x[i] = yn0;
+		}
+		for (int64_t i = 0, j = total - 1; i < j; i++, j--){
+			double t = x[i];
+			x[i] = x[j];
+			x[j] = t;
+		}
+	}
+	for (int64_t i = 0; i < size; i++)
+		output[i] = x[padlen + i];
+	sf_free(x);
+	return true;
+}
+
+// the zero-phase filter must give the same results on any number of threads, as close as rounding
+// allows: within twice the error of one thread from the double-precision version
+static void check_filtfilt(const char *label, const sf_biquad_state_st *bq,
+	const sf_sample_st *signal, sf_sample_st *output, sf_sample_st *single, double *ref){
+	char name[100];
+	if (!reference_filtfilt(bq, PARALLEL_SAMPLES, signal, ref)){
+		snprintf(name, sizeof(name), "%s (out of memory)", label);
+		check(false, name);
+		return;
+	}
+	memcpy(single, signal, sizeof(sf_sample_st) * PARALLEL_SAMPLES);
+	sf_biquad_filtfilt(bq, PARALLEL_SAMPLES, single, 1);
+	double serial = maxerror(PARALLEL_SAMPLES, single, ref);
+	for (int threads = 2; threads <= 16; threads *= 2){
+		memcpy(output, signal, sizeof(sf_sample_st) * PARALLEL_SAMPLES);
+		sf_biquad_filtfilt(bq, PARALLEL_SAMPLES, output, threads);
+		double diff = 0;
+		for (int64_t i = 0; i < PARALLEL_SAMPLES; i++){
+			double d = fmax(fabs(output[i].L - single[i].L), fabs(output[i].R - single[i].R));
+			if (d > diff)
+				diff = d;
+		}
+		snprintf(name, sizeof(name), "%s on %d threads (off by %.2g, serial error %.2g)", label,
+			threads, diff, serial);
+		check(diff <= serial * 2, name);
+	}
+}
+
+static void check_parallels(){
+	sf_sample_st *signal = (sf_sample_st *)sf_malloc(sizeof(sf_sample_st) * PARALLEL_SAMPLES);
+	sf_sample_st *output = (sf_sample_st *)sf_malloc(sizeof(sf_sample_st) * PARALLEL_SAMPLES);
+	sf_sample_st *single = (sf_sample_st *)sf_malloc(sizeof(sf_sample_st) * PARALLEL_SAMPLES);
+	double *ref = (double *)sf_malloc(sizeof(double) * PARALLEL_SAMPLES);
+	if (signal == NULL || output == NULL || single == NULL || ref == NULL){
+		check(false, "parallel biquad (out of memory)");
+	}
+	else{
+		fill_noise(signal, PARALLEL_SAMPLES);
+		sf_biquad_state_st bq[2];
+		sf_highpass(&bq[0], RATE, 30, 0);
+		check_parallel("parallel 30Hz highpass", bq, 1, signal, output, ref);
+		sf_peaking(&bq[0], RATE, 30, 20, 12);
+		check_parallel("parallel 30Hz Q20 peak", bq, 1, signal, output, ref);
+		sf_highpass(&bq[0], RATE, 30, 0);
+		sf_peaking(&bq[1], RATE, 50, 10, 12);
+		check_parallel("parallel highpass and peak chain", bq, 2, signal, output, ref);
+		sf_highpass(&bq[0], RATE, 20, 0.7f);
+		check_filtfilt("zero-phase 20Hz highpass", bq, signal, output, single, ref);
+		sf_peaking(&bq[0], RATE, 30, 20, 12);
+		check_filtfilt("zero-phase 30Hz Q20 peak", bq, signal, output, single, ref);
+	}
+	sf_free(signal);
+	sf_free(output);
+	sf_free(single);
+	sf_free(ref);
+}
+
+int main(){
+	sf_sample_st *signal = (sf_sample_st *)sf_malloc(sizeof(sf_sample_st) * SAMPLES);
+	if (signal == NULL){
+		fprintf(stderr, "Error: Out of memory\n");
+		return 1;
+	}
+	fill(signal, SAMPLES);
+
+	check_inplace(FILTER_BIQUAD, signal);
+	check_inplace(FILTER_COMPRESSOR, signal);
+	check_inplace(FILTER_REVERB, signal);
+	check_parallels();
+
+	sf_free(signal);
+	if (failures > 0){
+		printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}